@@ -0,0 +1,534 @@
+
+#include <string.h>
+#include <stdint.h>
+#include "Arduino.h"
+#include "DmmBatch.h"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+    #endif
+    #define BATCH_SIMD "SSE2"
+#elif defined(__ARM_NEON) && BATCH_NEON
+    #include <arm_neon.h>
+    #define BATCH_SIMD "NEON"
+#endif
+
+unsigned int EncodePackageBatchScalar(unsigned char func, const AxisPosition_t * setpoints, unsigned int count, unsigned char * out)
+{
+    unsigned char B[8], Package_Length;
+    unsigned int n = 0, i;
+    for (i = 0; i < count; i++) {
+        Package_Length = Encode_Package(func, setpoints[i].Axis, setpoints[i].Position, B);
+        memcpy(out + n, B, Package_Length);
+        n += Package_Length;
+    }
+    return n;
+}
+
+#ifdef BATCH_SIMD
+
+// Write the frames for four lanes. Data holds the payload bytes already
+// shifted so the first one is in the low byte; the checksum goes right
+// after them. Each frame is assembled as one little endian 64 bit word,
+// which is why the output needs a spare byte at the end.
+static unsigned char * EmitLanes(unsigned char * out, const uint32_t ID[4], const uint32_t B1[4],
+                                 const uint32_t Data[4], const uint32_t Length[4], const uint32_t CRC[4])
+{
+    int lane;
+    uint64_t w;
+    for (lane = 0; lane < 4; lane++) {
+        w = (uint64_t)ID[lane] | ((uint64_t)B1[lane] << 8) | ((uint64_t)Data[lane] << 16)
+            | ((uint64_t)CRC[lane] << (8 * (Length[lane] - 1)));
+        memcpy(out, &w, 8);
+        out += Length[lane];
+    }
+    return out;
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+static unsigned char * EncodeLanes(unsigned char func, const AxisPosition_t * setpoints, unsigned char * out)
+{
+    uint32_t ID[4], B1[4], Data[4], Length[4], CRC[4];
+    __m128i d, id, sign, fits6, fits5, fits4, extra, m, packed, shifted, b1, sum, crc;
+    const __m128i low7 = _mm_set1_epi32(0x7f);
+
+    d = _mm_set_epi32((int)setpoints[3].Position, (int)setpoints[2].Position,
+                      (int)setpoints[1].Position, (int)setpoints[0].Position);
+    id = _mm_and_si128(_mm_set_epi32(setpoints[3].Axis, setpoints[2].Axis,
+                                     setpoints[1].Axis, setpoints[0].Axis), low7);
+
+    // Length: a value fits n data bytes when shifting out those bits leaves
+    // only sign. The masks nest (fits4 implies fits5 implies fits6), so
+    // adding them (-1 each) to 3 gives the number of extra data bytes.
+    sign = _mm_srai_epi32(d, 31);
+    fits6 = _mm_cmpeq_epi32(_mm_srai_epi32(d, 20), sign);
+    fits5 = _mm_cmpeq_epi32(_mm_srai_epi32(d, 13), sign);
+    fits4 = _mm_cmpeq_epi32(_mm_srai_epi32(d, 6), sign);
+    extra = _mm_add_epi32(_mm_set1_epi32(3), _mm_add_epi32(fits6, _mm_add_epi32(fits5, fits4)));
+
+    // 7 bit split of the 28 bit value, most significant chunk in the low byte
+    m = _mm_and_si128(d, _mm_set1_epi32(0x0fffffff));
+    packed = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(m, 21), low7),
+             _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(m, 14), low7), 8),
+             _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(m, 7), low7), 16),
+                          _mm_slli_epi32(_mm_and_si128(m, low7), 24))));
+    packed = _mm_or_si128(packed, _mm_set1_epi32((int)0x80808080));
+
+    // Drop the leading chunks the short forms leave out
+#if defined(__AVX2__)
+    shifted = _mm_srlv_epi32(packed, _mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(3), extra), 3));
+#else
+    shifted = packed;
+    shifted = _mm_or_si128(_mm_and_si128(fits6, _mm_srli_epi32(packed, 8)), _mm_andnot_si128(fits6, shifted));
+    shifted = _mm_or_si128(_mm_and_si128(fits5, _mm_srli_epi32(packed, 16)), _mm_andnot_si128(fits5, shifted));
+    shifted = _mm_or_si128(_mm_and_si128(fits4, _mm_srli_epi32(packed, 24)), _mm_andnot_si128(fits4, shifted));
+#endif
+
+    b1 = _mm_add_epi32(_mm_set1_epi32(0x80 + (func & 0x1f)), _mm_slli_epi32(extra, 5));
+
+    // Checksum: low byte of the sum of every byte before it, top bit set
+    sum = _mm_add_epi32(_mm_add_epi32(shifted, _mm_srli_epi32(shifted, 8)),
+                        _mm_add_epi32(_mm_srli_epi32(shifted, 16), _mm_srli_epi32(shifted, 24)));
+    crc = _mm_add_epi32(sum, _mm_add_epi32(id, b1));
+    crc = _mm_or_si128(_mm_and_si128(crc, low7), _mm_set1_epi32(0x80));
+
+    _mm_storeu_si128((__m128i *)ID, id);
+    _mm_storeu_si128((__m128i *)B1, b1);
+    _mm_storeu_si128((__m128i *)Data, shifted);
+    _mm_storeu_si128((__m128i *)Length, _mm_add_epi32(extra, _mm_set1_epi32(4)));
+    _mm_storeu_si128((__m128i *)CRC, crc);
+    return EmitLanes(out, ID, B1, Data, Length, CRC);
+}
+
+#elif defined(__ARM_NEON) && BATCH_NEON
+
+static unsigned char * EncodeLanes(unsigned char func, const AxisPosition_t * setpoints, unsigned char * out)
+{
+    uint32_t ID[4], B1[4], Data[4], Length[4], CRC[4];
+    int32_t tmp[4];
+    int32x4_t d, sign, extra;
+    uint32x4_t id, fits6, fits5, fits4, m, packed, shifted, b1, sum, crc;
+    const uint32x4_t low7 = vdupq_n_u32(0x7f);
+    int lane;
+
+    for (lane = 0; lane < 4; lane++) tmp[lane] = (int32_t)setpoints[lane].Position;
+    d = vld1q_s32(tmp);
+    for (lane = 0; lane < 4; lane++) tmp[lane] = setpoints[lane].Axis;
+    id = vandq_u32(vreinterpretq_u32_s32(vld1q_s32(tmp)), low7);
+
+    // Same length classification as the SSE2 path
+    sign = vshrq_n_s32(d, 31);
+    fits6 = vceqq_s32(vshrq_n_s32(d, 20), sign);
+    fits5 = vceqq_s32(vshrq_n_s32(d, 13), sign);
+    fits4 = vceqq_s32(vshrq_n_s32(d, 6), sign);
+    extra = vaddq_s32(vdupq_n_s32(3), vaddq_s32(vreinterpretq_s32_u32(fits6),
+                      vaddq_s32(vreinterpretq_s32_u32(fits5), vreinterpretq_s32_u32(fits4))));
+
+    m = vandq_u32(vreinterpretq_u32_s32(d), vdupq_n_u32(0x0fffffff));
+    packed = vorrq_u32(vandq_u32(vshrq_n_u32(m, 21), low7),
+             vorrq_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(m, 14), low7), 8),
+             vorrq_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(m, 7), low7), 16),
+                       vshlq_n_u32(vandq_u32(m, low7), 24))));
+    packed = vorrq_u32(packed, vdupq_n_u32(0x80808080));
+
+    // Negative counts shift right
+    shifted = vshlq_u32(packed, vshlq_n_s32(vsubq_s32(extra, vdupq_n_s32(3)), 3));
+
+    b1 = vaddq_u32(vdupq_n_u32(0x80 + (func & 0x1f)), vshlq_n_u32(vreinterpretq_u32_s32(extra), 5));
+
+    sum = vaddq_u32(vaddq_u32(shifted, vshrq_n_u32(shifted, 8)),
+                    vaddq_u32(vshrq_n_u32(shifted, 16), vshrq_n_u32(shifted, 24)));
+    crc = vaddq_u32(sum, vaddq_u32(id, b1));
+    crc = vorrq_u32(vandq_u32(crc, low7), vdupq_n_u32(0x80));
+
+    vst1q_u32(ID, id);
+    vst1q_u32(B1, b1);
+    vst1q_u32(Data, shifted);
+    vst1q_u32(Length, vreinterpretq_u32_s32(vaddq_s32(extra, vdupq_n_s32(4))));
+    vst1q_u32(CRC, crc);
+    return EmitLanes(out, ID, B1, Data, Length, CRC);
+}
+
+#endif
+
+// Encode count frames of function func into out, which must hold
+// BATCH_BUFFER_SIZE(count) bytes. Returns the number of bytes of frames.
+unsigned int EncodePackageBatch(unsigned char func, const AxisPosition_t * setpoints, unsigned int count, unsigned char * out)
+{
+#ifdef BATCH_SIMD
+    unsigned char * p = out;
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        p = EncodeLanes(func, setpoints + i, p);
+    }
+    return (unsigned int)(p - out) + EncodePackageBatchScalar(func, setpoints + i, count - i, p);
+#else
+    return EncodePackageBatchScalar(func, setpoints, count, out);
+#endif
+}
+
+// Write packed frames to the drive. These bypass the per axis memory used
+// for CRC retransmission; a stream of setpoints supersedes itself anyway.
+void SendPackedFrames(const unsigned char * frames, unsigned int length)
+{
+    unsigned int i;
+    Stream * port = GetDmmPort();
+    for (i = 0; i < length; i++) {
+        port->write(frames[i]);
+    }
+}
+
+// Time the frame by frame Encode_Package path against EncodePackageBatch
+// on a spread of positions covering every frame length, and check the two
+// produce the same bytes.
+void EncodeBenchmark(unsigned long frames)
+{
+    const unsigned int chunk = 16;
+    static AxisPosition_t setpoints[16];
+    static unsigned char scalarOut[BATCH_BUFFER_SIZE(16)], batchOut[BATCH_BUFFER_SIZE(16)];
+    unsigned long i, reps = (frames + chunk - 1) / chunk, start, scalarMicros, batchMicros;
+    unsigned int k, scalarBytes = 0, batchBytes = 0;
+    long p = 1;
+
+    for (k = 0; k < chunk; k++) {
+        setpoints[k].Axis = k % 4;
+        setpoints[k].Position = (k & 1) ? -p : p;
+        p = (p * 5) & 0x07ffffff;
+    }
+
+    start = micros();
+    for (i = 0; i < reps; i++) {
+        scalarBytes = EncodePackageBatchScalar(Go_Absolute_Pos, setpoints, chunk, scalarOut);
+    }
+    scalarMicros = micros() - start;
+
+    start = micros();
+    for (i = 0; i < reps; i++) {
+        batchBytes = EncodePackageBatch(Go_Absolute_Pos, setpoints, chunk, batchOut);
+    }
+    batchMicros = micros() - start;
+
+    DMM_PRINTF("Encode %lu frames: scalar %lu us, batch %lu us\n", reps * chunk, scalarMicros, batchMicros);
+    if (scalarMicros && batchMicros) {
+        DMM_PRINTF("  scalar %lu frames/s, batch %lu frames/s\n",
+                   (unsigned long)(reps * chunk * 1000000.0 / scalarMicros),
+                   (unsigned long)(reps * chunk * 1000000.0 / batchMicros));
+    }
+    if (scalarBytes != batchBytes || memcmp(scalarOut, batchOut, scalarBytes) != 0) {
+        DMM_PRINTF("  MISMATCH between scalar and batch output\n");
+    }
+}
+
+// Find the next complete frame at or after *pos and return its bytes in
+// Frame, little endian and zero past the end. Like ReadPackage, a byte with
+// the top bit clear always starts a frame, so a frame cut short by a new
+// start byte is dropped. On failure *pos is left at the unfinished tail.
+static bool NextFrame(const unsigned char * buffer, unsigned int length, unsigned int * pos,
+                      uint64_t * Frame, unsigned char * Package_Length)
+{
+    unsigned int i = *pos, j;
+    unsigned char l;
+    uint64_t w, clear;
+    while (i < length) {
+        if (buffer[i] & 0x80) { // not a start byte
+            i++;
+            continue;
+        }
+        if (i + 1 >= length) {
+            break;
+        }
+        l = 4 + ((buffer[i + 1] >> 5) & 0x03);
+        if (i + l > length) {
+            break;
+        }
+        w = 0;
+        if (i + 8 <= length) {
+            memcpy(&w, buffer + i, 8);
+            w &= ((uint64_t)1 << (8 * l)) - 1;
+        } else {
+            memcpy(&w, buffer + i, l);
+        }
+        // Every byte after the first must have its top bit set
+        clear = ~w & 0x8080808080808000ULL & (((uint64_t)1 << (8 * l)) - 1);
+        if (clear) { // resync on the start byte inside this frame
+            for (j = i + 1; buffer[j] & 0x80; j++) ;
+            i = j;
+            continue;
+        }
+        *Frame = w;
+        *Package_Length = l;
+        *pos = i + l;
+        return true;
+    }
+    *pos = i;
+    return false;
+}
+
+static void DecodeFrame(uint64_t Frame, unsigned char Package_Length, DecodedReplies_t * out, unsigned int k)
+{
+    unsigned char B[8], CRC_Check = 0, code;
+    int i;
+    memcpy(B, &Frame, 8);
+    for (i = 0; i < Package_Length - 1; i++) {
+        CRC_Check += B[i];
+    }
+    code = B[1] & 0x1f;
+    out->Axis[k] = B[0] & 0x7f;
+    out->Code[k] = code;
+    out->Valid[k] = ((CRC_Check ^ B[Package_Length - 1]) & 0x7f) == 0;
+    out->Value[k] = IsUnsignedParameter(code) ? (long)Cal_UnsignedValue(B) : Cal_SignValue(B);
+}
+
+unsigned int DecodePackageBatchScalar(const unsigned char * buffer, unsigned int length, DecodedReplies_t * out, unsigned int * consumed)
+{
+    unsigned int pos = 0, n = 0;
+    unsigned char Package_Length;
+    uint64_t Frame;
+    while (n < out->MaxFrames && NextFrame(buffer, length, &pos, &Frame, &Package_Length)) {
+        DecodeFrame(Frame, Package_Length, out, n++);
+    }
+    if (consumed) {
+        *consumed = pos;
+    }
+    return n;
+}
+
+#ifdef BATCH_SIMD
+
+// Split four frames into lanes: bytes 0-3 and 4-7 as little endian words,
+// the checksum byte, the number of data bytes and whether the code is
+// unsigned (bit n of UnsignedCodes set for unsigned Is_ code n).
+static void GatherLanes(const uint64_t Frame[4], const unsigned char Package_Length[4], uint32_t UnsignedCodes,
+                        uint32_t Lo[4], uint32_t Hi[4], uint32_t CRC[4], uint32_t DataBytes[4], uint32_t Unsigned[4])
+{
+    int lane;
+    for (lane = 0; lane < 4; lane++) {
+        Lo[lane] = (uint32_t)Frame[lane];
+        Hi[lane] = (uint32_t)(Frame[lane] >> 32);
+        CRC[lane] = (uint32_t)(Frame[lane] >> (8 * (Package_Length[lane] - 1)));
+        DataBytes[lane] = Package_Length[lane] - 3;
+        Unsigned[lane] = ((UnsignedCodes >> ((Lo[lane] >> 8) & 0x1f)) & 1) ? 0xffffffff : 0;
+    }
+}
+
+static uint32_t UnsignedCodeMask()
+{
+    static uint32_t mask = 0;
+    unsigned char code;
+    if (mask == 0) {
+        for (code = 0; code < 32; code++) {
+            if (IsUnsignedParameter(code)) {
+                mask |= (uint32_t)1 << code;
+            }
+        }
+    }
+    return mask;
+}
+
+static void ScatterLanes(DecodedReplies_t * out, unsigned int k, const uint32_t Axis[4], const uint32_t Code[4],
+                         const int32_t Value[4], const uint32_t Valid[4])
+{
+    int lane;
+    for (lane = 0; lane < 4; lane++) {
+        out->Axis[k + lane] = (char)Axis[lane];
+        out->Code[k + lane] = (unsigned char)Code[lane];
+        out->Value[k + lane] = Value[lane];
+        out->Valid[k + lane] = Valid[lane] != 0;
+    }
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+static __m128i ByteSum(__m128i x)
+{
+    return _mm_add_epi32(_mm_add_epi32(x, _mm_srli_epi32(x, 8)),
+                         _mm_add_epi32(_mm_srli_epi32(x, 16), _mm_srli_epi32(x, 24)));
+}
+
+static void DecodeLanes(const uint64_t Frame[4], const unsigned char Package_Length[4], uint32_t UnsignedCodes,
+                        DecodedReplies_t * out, unsigned int k)
+{
+    uint32_t Lo[4], Hi[4], CRC[4], DataBytes[4], Unsigned[4], Axis[4], Code[4], Valid[4];
+    int32_t Value[4];
+    __m128i lo, hi, crc, n, uns, sum, raw, sra, srl;
+    const __m128i low7 = _mm_set1_epi32(0x7f);
+
+    GatherLanes(Frame, Package_Length, UnsignedCodes, Lo, Hi, CRC, DataBytes, Unsigned);
+    lo = _mm_loadu_si128((const __m128i *)Lo);
+    hi = _mm_loadu_si128((const __m128i *)Hi);
+    crc = _mm_loadu_si128((const __m128i *)CRC);
+    n = _mm_loadu_si128((const __m128i *)DataBytes);
+    uns = _mm_loadu_si128((const __m128i *)Unsigned);
+
+    // Bytes past the frame are zero, so the sum of everything but the
+    // checksum is the sum of all bytes minus the checksum
+    sum = _mm_sub_epi32(_mm_add_epi32(ByteSum(lo), ByteSum(hi)), crc);
+    _mm_storeu_si128((__m128i *)Valid, _mm_cmpeq_epi32(_mm_and_si128(_mm_xor_si128(sum, crc), low7), _mm_setzero_si128()));
+
+    // Data bytes 2-5 as 7 bit chunks, first chunk at the top of the word.
+    // Short frames are then aligned (and sign extended) by one right shift
+    // of 4 + 7 * (4 - data bytes), which also drops the checksum chunk.
+    raw = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), low7), 25),
+                                    _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(lo, 24), low7), 18)),
+                       _mm_or_si128(_mm_slli_epi32(_mm_and_si128(hi, low7), 11),
+                                    _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(hi, 8), low7), 4)));
+#if defined(__AVX2__)
+    {
+        __m128i shift = _mm_sub_epi32(_mm_set1_epi32(32), _mm_mullo_epi32(n, _mm_set1_epi32(7)));
+        sra = _mm_srav_epi32(raw, shift);
+        srl = _mm_srlv_epi32(raw, shift);
+    }
+#else
+    {
+        __m128i n1 = _mm_cmpeq_epi32(n, _mm_set1_epi32(1));
+        __m128i n2 = _mm_cmpeq_epi32(n, _mm_set1_epi32(2));
+        __m128i n3 = _mm_cmpeq_epi32(n, _mm_set1_epi32(3));
+        sra = _mm_srai_epi32(raw, 4);
+        sra = _mm_or_si128(_mm_and_si128(n3, _mm_srai_epi32(raw, 11)), _mm_andnot_si128(n3, sra));
+        sra = _mm_or_si128(_mm_and_si128(n2, _mm_srai_epi32(raw, 18)), _mm_andnot_si128(n2, sra));
+        sra = _mm_or_si128(_mm_and_si128(n1, _mm_srai_epi32(raw, 25)), _mm_andnot_si128(n1, sra));
+        srl = _mm_srli_epi32(raw, 4);
+        srl = _mm_or_si128(_mm_and_si128(n3, _mm_srli_epi32(raw, 11)), _mm_andnot_si128(n3, srl));
+        srl = _mm_or_si128(_mm_and_si128(n2, _mm_srli_epi32(raw, 18)), _mm_andnot_si128(n2, srl));
+        srl = _mm_or_si128(_mm_and_si128(n1, _mm_srli_epi32(raw, 25)), _mm_andnot_si128(n1, srl));
+    }
+#endif
+    _mm_storeu_si128((__m128i *)Value, _mm_or_si128(_mm_and_si128(uns, srl), _mm_andnot_si128(uns, sra)));
+    _mm_storeu_si128((__m128i *)Axis, _mm_and_si128(lo, low7));
+    _mm_storeu_si128((__m128i *)Code, _mm_and_si128(_mm_srli_epi32(lo, 8), _mm_set1_epi32(0x1f)));
+    ScatterLanes(out, k, Axis, Code, Value, Valid);
+}
+
+#elif defined(__ARM_NEON) && BATCH_NEON
+
+static uint32x4_t ByteSum(uint32x4_t x)
+{
+    return vaddq_u32(vaddq_u32(x, vshrq_n_u32(x, 8)), vaddq_u32(vshrq_n_u32(x, 16), vshrq_n_u32(x, 24)));
+}
+
+static void DecodeLanes(const uint64_t Frame[4], const unsigned char Package_Length[4], uint32_t UnsignedCodes,
+                        DecodedReplies_t * out, unsigned int k)
+{
+    uint32_t Lo[4], Hi[4], CRC[4], DataBytes[4], Unsigned[4], Axis[4], Code[4], Valid[4];
+    int32_t Value[4];
+    uint32x4_t lo, hi, crc, uns, sum, raw;
+    int32x4_t shift;
+    const uint32x4_t low7 = vdupq_n_u32(0x7f);
+
+    GatherLanes(Frame, Package_Length, UnsignedCodes, Lo, Hi, CRC, DataBytes, Unsigned);
+    lo = vld1q_u32(Lo);
+    hi = vld1q_u32(Hi);
+    crc = vld1q_u32(CRC);
+    uns = vld1q_u32(Unsigned);
+
+    // Same layout as the SSE2 path
+    sum = vsubq_u32(vaddq_u32(ByteSum(lo), ByteSum(hi)), crc);
+    vst1q_u32(Valid, vceqq_u32(vandq_u32(veorq_u32(sum, crc), low7), vdupq_n_u32(0)));
+
+    raw = vorrq_u32(vorrq_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(lo, 16), low7), 25),
+                              vshlq_n_u32(vandq_u32(vshrq_n_u32(lo, 24), low7), 18)),
+                    vorrq_u32(vshlq_n_u32(vandq_u32(hi, low7), 11),
+                              vshlq_n_u32(vandq_u32(vshrq_n_u32(hi, 8), low7), 4)));
+    // Negative counts shift right
+    shift = vsubq_s32(vmulq_n_s32(vreinterpretq_s32_u32(vld1q_u32(DataBytes)), 7), vdupq_n_s32(32));
+    vst1q_s32(Value, vbslq_s32(uns, vreinterpretq_s32_u32(vshlq_u32(raw, shift)),
+                               vshlq_s32(vreinterpretq_s32_u32(raw), shift)));
+    vst1q_u32(Axis, vandq_u32(lo, low7));
+    vst1q_u32(Code, vandq_u32(vshrq_n_u32(lo, 8), vdupq_n_u32(0x1f)));
+    ScatterLanes(out, k, Axis, Code, Value, Valid);
+}
+
+#endif
+
+// Decode up to out->MaxFrames replies from buffer. Returns the number of
+// frames written to out; *consumed is how far into buffer they went, so an
+// unfinished trailing frame can be kept for the next call.
+unsigned int DecodePackageBatch(const unsigned char * buffer, unsigned int length, DecodedReplies_t * out, unsigned int * consumed)
+{
+#ifdef BATCH_SIMD
+    unsigned int pos = 0, n = 0, lanes, lane;
+    unsigned char Package_Length[4];
+    uint64_t Frame[4];
+    uint32_t UnsignedCodes = UnsignedCodeMask();
+    do {
+        lanes = 0;
+        while (lanes < 4 && n + lanes < out->MaxFrames
+               && NextFrame(buffer, length, &pos, &Frame[lanes], &Package_Length[lanes])) {
+            lanes++;
+        }
+        if (lanes == 4) {
+            DecodeLanes(Frame, Package_Length, UnsignedCodes, out, n);
+        } else {
+            for (lane = 0; lane < lanes; lane++) {
+                DecodeFrame(Frame[lane], Package_Length[lane], out, n + lane);
+            }
+        }
+        n += lanes;
+    } while (lanes == 4);
+    if (consumed) {
+        *consumed = pos;
+    }
+    return n;
+#else
+    return DecodePackageBatchScalar(buffer, length, out, consumed);
+#endif
+}
+
+// Time frame by frame decoding against DecodePackageBatch on replies of
+// every length, one in eight with a bad checksum, and compare the results.
+void DecodeBenchmark(unsigned long frames)
+{
+    const unsigned int chunk = 16;
+    static unsigned char replies[BATCH_BUFFER_SIZE(16)];
+    static char axis[2][16];
+    static unsigned char code[2][16];
+    static long value[2][16];
+    static bool valid[2][16];
+    DecodedReplies_t scalarOut = { axis[0], code[0], value[0], valid[0], 16 };
+    DecodedReplies_t batchOut = { axis[1], code[1], value[1], valid[1], 16 };
+    unsigned long i, reps = (frames + chunk - 1) / chunk, start, scalarMicros, batchMicros;
+    unsigned int k, length = 0, scalarFrames = 0, batchFrames = 0;
+    unsigned char B[8], l;
+    long p = 1;
+
+    for (k = 0; k < chunk; k++) {
+        l = Encode_Package((k & 2) ? Is_MainGain : Is_AbsPos32, k % 4, (k & 1) ? -p : p, B);
+        if (k % 8 == 7) {
+            B[l - 1] ^= 0x01;
+        }
+        memcpy(replies + length, B, l);
+        length += l;
+        p = (p * 5) & 0x07ffffff;
+    }
+
+    start = micros();
+    for (i = 0; i < reps; i++) {
+        scalarFrames = DecodePackageBatchScalar(replies, length, &scalarOut, 0);
+    }
+    scalarMicros = micros() - start;
+
+    start = micros();
+    for (i = 0; i < reps; i++) {
+        batchFrames = DecodePackageBatch(replies, length, &batchOut, 0);
+    }
+    batchMicros = micros() - start;
+
+    DMM_PRINTF("Decode %lu frames: scalar %lu us, batch %lu us\n", reps * chunk, scalarMicros, batchMicros);
+    if (scalarMicros && batchMicros) {
+        DMM_PRINTF("  scalar %lu frames/s, batch %lu frames/s\n",
+                   (unsigned long)(reps * chunk * 1000000.0 / scalarMicros),
+                   (unsigned long)(reps * chunk * 1000000.0 / batchMicros));
+    }
+    if (scalarFrames != batchFrames
+        || memcmp(axis[0], axis[1], sizeof(axis[0])) || memcmp(code[0], code[1], sizeof(code[0]))
+        || memcmp(value[0], value[1], sizeof(value[0])) || memcmp(valid[0], valid[1], sizeof(valid[0]))) {
+        DMM_PRINTF("  MISMATCH between scalar and batch output\n");
+    }
+}
@@ -0,0 +1,54 @@
+/*
+
+Batch encoding of position setpoints. Trajectory playback hands over an
+array of (axis, position) pairs and gets back one packed TX buffer holding
+the same frames Send_Package would have written, byte for byte. On hosts
+with SSE2 (AVX2 when enabled) the 7-bit splitting, length selection and
+checksum run four setpoints at a time; elsewhere (AVR, and ARM unless
+BATCH_NEON is set) the scalar Encode_Package is used.
+
+The decoder goes the other way for captured or streamed replies: it frames
+a buffer of drive replies, checks each checksum and rebuilds the signed or
+unsigned value (as Get_Function would) for four frames at a time, writing
+a struct of arrays ready for analysis.
+
+*/
+
+#ifndef DmmDriver_DmmBatch_h
+#define DmmDriver_DmmBatch_h
+
+#include "DmmDriver.h"
+
+#ifndef BATCH_NEON
+    // The NEON paths have only been run against a model of the intrinsics,
+    // not built for ARM: set to 1 once they match the scalar path there
+    #define BATCH_NEON 0
+#endif
+
+typedef struct {
+    long Position; // -2^27 ~ 2^27 - 1, as for Send_Package
+    char Axis;
+} AxisPosition_t;
+
+// TX buffer size for count frames; the vector path may write one byte past
+// the last frame
+#define BATCH_BUFFER_SIZE(count) ((count) * 7 + 1)
+
+// Caller owned output arrays for DecodePackageBatch, each MaxFrames long
+typedef struct {
+    char * Axis;
+    unsigned char * Code;  // Is_ code of the reply
+    long * Value;
+    bool * Valid;          // checksum correct
+    unsigned int MaxFrames;
+} DecodedReplies_t;
+
+unsigned int EncodePackageBatch(unsigned char func, const AxisPosition_t * setpoints, unsigned int count, unsigned char * out) ;
+unsigned int EncodePackageBatchScalar(unsigned char func, const AxisPosition_t * setpoints, unsigned int count, unsigned char * out) ;
+void SendPackedFrames(const unsigned char * frames, unsigned int length) ;
+void EncodeBenchmark(unsigned long frames) ;
+unsigned int DecodePackageBatch(const unsigned char * buffer, unsigned int length, DecodedReplies_t * out, unsigned int * consumed) ;
+unsigned int DecodePackageBatchScalar(const unsigned char * buffer, unsigned int length, DecodedReplies_t * out, unsigned int * consumed) ;
+void DecodeBenchmark(unsigned long frames) ;
+
+#endif // DmmDriver_DmmBatch_h
@@ -0,0 +1,185 @@
+
+#include <limits.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "DmmBench.h"
+
+#define BENCH_QUERY_TIMEOUT 20 // ms to wait for one reply
+#define BENCH_STATUS_EVERY 4   // read the status byte once per this many positions
+#define BENCH_SETTLE_HOLD 50   // ms inside the window before a move counts as settled
+#define BENCH_MOTION 2         // counts of travel that show the shaft has responded
+#define BENCH_SPEED_WINDOW 20  // ms between positions used for a speed estimate
+
+static const char ShortMove[] DMM_PROGMEM = "Short move";
+static const char LongMove[] DMM_PROGMEM = "Long move";
+static const char Reversal[] DMM_PROGMEM = "Reversal";
+static const char SetpointRush[] DMM_PROGMEM = "Setpoint rush";
+
+const MoveProfile_t MoveProfiles[] = {
+    { ShortMove,    Profile_Move,     200,   0,  0, 2000 },
+    { LongMove,     Profile_Move,     20000, 0,  0, 5000 },
+    { Reversal,     Profile_Reversal, 0,     10, 0, 3000 },
+    { SetpointRush, Profile_Stream,   1000,  0,  100, 5000 },
+};
+const unsigned char MoveProfileCount = sizeof(MoveProfiles) / sizeof(MoveProfiles[0]);
+
+// Keep every sample until the trace is full, then drop every other one and
+// keep sampling at half the rate, so a trace always spans the whole run.
+// Samples count from 1, so the trace holds samples stride, 2 * stride, ...
+// and the ones kept on thinning, multiples of the new stride, are those at
+// odd indices: the trace stays evenly spaced.
+static void Record(ProfileResult_t * result, unsigned int * stride, unsigned int sample,
+                   unsigned long t, long pos, unsigned char status) {
+    unsigned int i;
+    if (sample % *stride) {
+        return;
+    }
+    if (result->TraceCount == BENCH_TRACE_SIZE) {
+        for (i = 0; i < BENCH_TRACE_SIZE / 2; i++) {
+            result->Trace[i] = result->Trace[2 * i + 1];
+        }
+        result->TraceCount = BENCH_TRACE_SIZE / 2;
+        *stride *= 2;
+        if (sample % *stride) {
+            return;
+        }
+    }
+    result->Trace[result->TraceCount].Time = t;
+    result->Trace[result->TraceCount].Position = pos;
+    result->Trace[result->TraceCount].Status = status;
+    result->TraceCount++;
+}
+
+bool RunMoveProfile(char Axis_Num, const MoveProfile_t * profile, ProfileResult_t * result) {
+    unsigned long start, t, prevT = 0, inWindowSince = 0;
+    unsigned int sample = 0, stride = 1, sent = 0;
+    long onRange, from, target, pos, prevPos, peak, speed = 0, cruise = 0;
+    unsigned char status = 0;
+    long v;
+    int dir;
+
+    result->LatencyMs = result->SettleMs = profile->TimeoutMs;
+    result->Overshoot = 0;
+    result->MovesPerHour = 0;
+    result->Settled = false;
+    result->TraceCount = 0;
+
+    onRange = QueryDrive(Read_Pos_OnRange, Axis_Num, 0, BENCH_QUERY_TIMEOUT);
+    from = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, BENCH_QUERY_TIMEOUT);
+    if (onRange == LONG_MIN || from == LONG_MIN) {
+        return false;
+    }
+    target = from + profile->Distance;
+    dir = (profile->Distance >= 0) ? 1 : -1;
+
+    if (profile->Kind == Profile_Reversal) {
+        // Reach a steady speed first, then time the reversal from there
+        MoveMotorConstantRotation(Axis_Num, profile->Speed);
+        start = millis();
+        prevPos = from;
+        while (millis() - start < profile->TimeoutMs / 2) {
+            pos = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, BENCH_QUERY_TIMEOUT);
+            t = millis();
+            if (pos != LONG_MIN && t - prevT >= BENCH_SPEED_WINDOW) {
+                cruise = (pos - prevPos) * 1000 / (long)(t - prevT);
+                prevPos = pos;
+                prevT = t;
+            }
+        }
+        from = prevPos;
+        dir = (cruise >= 0) ? 1 : -1;
+        MoveMotorConstantRotation(Axis_Num, -profile->Speed);
+    } else if (profile->Kind == Profile_Move) {
+        MoveMotorToAbsolutePosition32(Axis_Num, target);
+    }
+    start = millis();
+    prevPos = peak = from;
+    prevT = 0;
+
+    while ((t = millis() - start) < profile->TimeoutMs) {
+        if (profile->Kind == Profile_Stream && sent < profile->Count) {
+            sent++;
+            MoveMotorToAbsolutePosition32(Axis_Num, from + profile->Distance * (long)sent / (long)profile->Count);
+        }
+        pos = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, BENCH_QUERY_TIMEOUT);
+        if (pos == LONG_MIN) {
+            continue;
+        }
+        sample++;
+        if (sample % BENCH_STATUS_EVERY == 0) {
+            v = QueryDrive(Read_Drive_Status, Axis_Num, 0, BENCH_QUERY_TIMEOUT);
+            if (v != LONG_MIN) {
+                status = (unsigned char)v;
+            }
+        }
+        Record(result, &stride, sample, t, pos, status);
+
+        if (profile->Kind == Profile_Reversal) {
+            // Overshoot: travel on in the old direction after the command.
+            // Latency: speed first drops below 90% of cruise. Settled: speed
+            // within 10% of the reversed cruise speed.
+            if ((pos - peak) * dir > 0) {
+                peak = pos;
+            }
+            if (t - prevT >= BENCH_SPEED_WINDOW) {
+                speed = (pos - prevPos) * 1000 / (long)(t - prevT);
+                prevPos = pos;
+                prevT = t;
+                if (result->LatencyMs == profile->TimeoutMs && speed * dir * 10 < labs(cruise) * 9) {
+                    result->LatencyMs = t;
+                }
+                if (labs(speed + cruise) * 10 <= labs(cruise)) {
+                    result->SettleMs = t;
+                    result->Settled = true;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (result->LatencyMs == profile->TimeoutMs && labs(pos - from) >= BENCH_MOTION) {
+            result->LatencyMs = t;
+        }
+        result->Overshoot = MAX(result->Overshoot, (pos - target) * dir);
+        if ((profile->Kind == Profile_Move || sent == profile->Count) && labs(target - pos) <= onRange) {
+            if (inWindowSince == 0) {
+                inWindowSince = t ? t : 1;
+            } else if (t - inWindowSince >= BENCH_SETTLE_HOLD) {
+                result->SettleMs = inWindowSince;
+                result->Settled = true;
+                break;
+            }
+        } else {
+            inWindowSince = 0;
+        }
+    }
+
+    if (profile->Kind == Profile_Reversal) {
+        MoveMotorConstantRotation(Axis_Num, 0);
+        result->Overshoot = (peak - from) * dir;
+    }
+    if (result->Settled && result->SettleMs) {
+        result->MovesPerHour = 3600000UL / result->SettleMs;
+    }
+    return true;
+}
+
+// Run every profile in MoveProfiles with the given limits and print a table
+void RunMotionBenchmark(char Axis_Num, unsigned char maxSpeed, unsigned char maxAccel) {
+    static ProfileResult_t result;
+    unsigned char i;
+
+    SetMaxSpeed(Axis_Num, maxSpeed);
+    SetMaxAccel(Axis_Num, maxAccel);
+    DMM_PRINTF("Motion benchmark, max speed %d, max accel %d\n", maxSpeed, maxAccel);
+    DMM_PRINTF("Profile         Latency   Settle Overshoot    Moves/h\n");
+    for (i = 0; i < MoveProfileCount; i++) {
+        if (!RunMoveProfile(Axis_Num, &MoveProfiles[i], &result)) {
+            DMM_PRINTF(DMM_STR_FMT_PAD(14) " no reply from drive\n", MoveProfiles[i].Name);
+            continue;
+        }
+        DMM_PRINTF(DMM_STR_FMT_PAD(14) " %6lums %6lums%s %9ld %10lu\n", MoveProfiles[i].Name,
+                   result.LatencyMs, result.SettleMs, result.Settled ? " " : "!",
+                   result.Overshoot, result.MovesPerHour);
+    }
+}
@@ -0,0 +1,50 @@
+/*
+
+Motion quality benchmark. Runs a library of move profiles (short and long
+absolute moves, Turn_ConstSpeed reversals, a rapid stream of setpoints)
+against a drive or a DmmSimDrive, records a position/status trace of each
+and reports command-to-motion latency, settling time into the drive's own
+Read_Pos_OnRange window, overshoot and the resulting moves per hour, so
+SetMaxSpeed/SetMaxAccel can be chosen from numbers instead of by feel.
+
+*/
+
+#ifndef DmmDriver_DmmBench_h
+#define DmmDriver_DmmBench_h
+
+#include "DmmDriver.h"
+
+typedef enum { Profile_Move, Profile_Reversal, Profile_Stream } ProfileKind_t;
+
+typedef struct {
+    const char * Name;      // in flash with DMM_LOW_FOOTPRINT, print with DMM_STR_FMT
+    ProfileKind_t Kind;
+    long Distance;          // counts: move length, or stream length
+    long Speed;             // Turn_ConstSpeed value for reversals
+    unsigned int Count;     // setpoints in a stream
+    unsigned int TimeoutMs;
+} MoveProfile_t;
+
+typedef struct {
+    unsigned long Time;     // ms since the profile's first command
+    long Position;
+    unsigned char Status;
+} TraceSample_t;
+
+typedef struct {
+    unsigned long LatencyMs;   // command until the shaft is seen to respond
+    unsigned long SettleMs;    // command until settled (TimeoutMs if never)
+    long Overshoot;            // counts past the target / past the reversal point
+    unsigned long MovesPerHour; // whole profiles; a stream counts as one move
+    bool Settled;
+    TraceSample_t Trace[BENCH_TRACE_SIZE];
+    unsigned int TraceCount;   // samples kept, evenly thinned when the run is long
+} ProfileResult_t;
+
+extern const MoveProfile_t MoveProfiles[];
+extern const unsigned char MoveProfileCount;
+
+bool RunMoveProfile(char Axis_Num, const MoveProfile_t * profile, ProfileResult_t * result) ;
+void RunMotionBenchmark(char Axis_Num, unsigned char maxSpeed, unsigned char maxAccel) ;
+
+#endif // DmmDriver_DmmBench_h
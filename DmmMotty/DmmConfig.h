@@ -0,0 +1,79 @@
+/*
+
+Build profile for the DMM driver. The Arduino IDE offers no way to pass -D
+flags, so edit the defaults here (or #define them before DmmDriver.h).
+
+DMM_DIAGNOSTICS 0    : strips every printf text from the driver
+DMM_LOW_FOOTPRINT 1  : on AVR, keeps constant strings in flash (PROGMEM)
+                       and prints them with printf_P, leaving SRAM free for
+                       larger buffers and more axes
+
+PrintMemoryUsage() reports what a given profile costs at run time. It
+prints through DMM_REPORTF, which DMM_DIAGNOSTICS 0 leaves in place, so it
+works in the profile it is there to measure.
+
+*/
+
+#ifndef DmmDriver_DmmConfig_h
+#define DmmDriver_DmmConfig_h
+
+#ifndef DMM_DIAGNOSTICS
+    #define DMM_DIAGNOSTICS 1
+#endif
+
+#ifndef DMM_LOW_FOOTPRINT
+    #define DMM_LOW_FOOTPRINT 0
+#endif
+
+#ifndef DMM_MAX_AXES
+    #define DMM_MAX_AXES 4 // axes with a remembered command frame, for retransmission
+#endif
+
+#ifndef DMM_MAX_QUERIES
+    #define DMM_MAX_QUERIES 4 // queries awaiting a reply that can be resent, for pipelined reads
+#endif
+
+#ifndef DMM_RX_BUFFER_SIZE
+    #define DMM_RX_BUFFER_SIZE 64 // receive ring, keep a power of two so the wrap is cheap
+#endif
+
+#ifndef DMM_BAUD_RATE
+    #define DMM_BAUD_RATE 38400 // the drives' rate, for timing frames on the wire
+#endif
+#define DMM_BYTE_US (10000000UL / DMM_BAUD_RATE) // start, 8 data and stop bits
+
+#ifndef DMM_TURNAROUND_US
+    #define DMM_TURNAROUND_US 1000 // a drive's delay before it replies
+#endif
+
+#ifndef BENCH_TRACE_SIZE // samples RunMotionBenchmark() keeps per profile, 9 bytes each
+    #if DMM_LOW_FOOTPRINT
+        #define BENCH_TRACE_SIZE 16
+    #else
+        #define BENCH_TRACE_SIZE 64
+    #endif
+#endif
+
+#if DMM_LOW_FOOTPRINT && defined(__AVR__)
+    #include <avr/pgmspace.h>
+    #define DMM_PROGMEM PROGMEM
+    #define DMM_STR(s) PSTR(s)
+    #define DMM_PRINTF(fmt, ...) printf_P(PSTR(fmt), ##__VA_ARGS__)
+    #define DMM_REPORTF(fmt, ...) printf_P(PSTR(fmt), ##__VA_ARGS__)
+    #define DMM_STR_FMT "%S" // printf_P conversion for a DMM_STR argument
+    #define DMM_STR_FMT_PAD(width) "%-" #width "S" // the same, left aligned
+#else
+    #define DMM_PROGMEM
+    #define DMM_STR(s) (s)
+    #define DMM_PRINTF(fmt, ...) printf(fmt, ##__VA_ARGS__)
+    #define DMM_REPORTF(fmt, ...) printf(fmt, ##__VA_ARGS__)
+    #define DMM_STR_FMT "%s"
+    #define DMM_STR_FMT_PAD(width) "%-" #width "s"
+#endif
+
+#if !DMM_DIAGNOSTICS
+    #undef DMM_PRINTF
+    #define DMM_PRINTF(fmt, ...) ((void)0)
+#endif
+
+#endif // DmmDriver_DmmConfig_h
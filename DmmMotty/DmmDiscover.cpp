@@ -0,0 +1,148 @@
+#include <string.h>
+#include "Arduino.h"
+#include "DmmDiscover.h"
+
+#define DISCOVER_STEPS 4 // Read_Drive_ID, then the follow up reads
+
+static const unsigned char StepFunc[DISCOVER_STEPS] = { Read_Drive_ID, Read_Drive_Status, Read_GearNumber, Read_Drive_Config };
+static const unsigned char StepCode[DISCOVER_STEPS] = { Is_Drive_ID, Is_Status, Is_GearNumber, Is_Config };
+
+// One conversation with one ID: the probe, then the follow ups if it answered
+typedef struct {
+    char ID;
+    unsigned char Step;
+    unsigned char Tries;
+    unsigned char Drive;    // index into Found once the ID has answered
+    unsigned long Deadline; // micros()
+    bool Busy;
+} DiscoverSlot_t;
+
+static DiscoverSlot_t Slots[DISCOVER_WINDOW];
+static unsigned char Answered[(DISCOVER_MAX_ID + 8) / 8]; // bit per ID
+static DiscoveredDrive_t * Found;
+static unsigned char FoundCount, FoundMax;
+static unsigned long LineFreeAt; // micros() when the requests sent so far are out
+
+static void SendStep(DiscoverSlot_t * slot) {
+    unsigned long now = micros();
+    Send_Package(StepFunc[slot->Step], slot->ID, 0); // 0: Dummy Data
+    if ((long)(LineFreeAt - now) < 0) {
+        LineFreeAt = now;
+    }
+    LineFreeAt += DISCOVER_FRAME_BYTES * DMM_BYTE_US;
+    slot->Deadline = LineFreeAt + DISCOVER_TIMEOUT_US;
+}
+
+static void NextStep(DiscoverSlot_t * slot) {
+    slot->Step++;
+    slot->Tries = 1;
+    if (slot->Step == DISCOVER_STEPS) {
+        slot->Busy = false;
+    } else {
+        SendStep(slot);
+    }
+}
+
+static void OnReply(char ID, unsigned char code, long value) {
+    DiscoveredDrive_t * drive;
+    DiscoverSlot_t * slot;
+    unsigned char i;
+
+    for (i = 0; i < DISCOVER_WINDOW; i++) {
+        slot = &Slots[i];
+        if (!slot->Busy || slot->ID != ID || StepCode[slot->Step] != code) {
+            continue;
+        }
+        if (slot->Step == 0) {
+            if (FoundCount == FoundMax) {
+                slot->Busy = false; // no room to keep it
+                return;
+            }
+            Answered[ID / 8] |= 1 << (ID % 8);
+            slot->Drive = FoundCount++;
+            drive = &Found[slot->Drive];
+            drive->ID = ID;
+            drive->Status = drive->Config = 0;
+            drive->GearNumber = 0;
+            drive->Missing = (1 << (DISCOVER_STEPS - 1)) - 1;
+        } else {
+            drive = &Found[slot->Drive];
+            switch (code) {
+                case Is_Status: drive->Status = value; break;
+                case Is_GearNumber: drive->GearNumber = value; break;
+                case Is_Config: drive->Config = value; break;
+            }
+            drive->Missing &= ~(1 << (slot->Step - 1));
+        }
+        NextStep(slot);
+        return;
+    }
+}
+
+// Next ID at or after id that has not answered yet, DISCOVER_MAX_ID + 1 when none
+static unsigned char Unanswered(unsigned char id) {
+    while (id <= DISCOVER_MAX_ID && (Answered[id / 8] & (1 << (id % 8)))) {
+        id++;
+    }
+    return id;
+}
+
+// Probe the whole ID space and fill found with the drives that answered, in
+// the order they did, sweeping the IDs still silent DISCOVER_PASSES times.
+// Returns how many; stops early after timeoutMs.
+unsigned char DiscoverDrives(DiscoveredDrive_t * found, unsigned char maxFound, unsigned int timeoutMs) {
+    ReadCallback_t saved = GetReadCallback();
+    unsigned long start = millis(), now;
+    unsigned char nextID = 0, pass = 1, i;
+    DiscoverSlot_t * slot;
+    bool busy;
+
+    Found = found;
+    FoundMax = maxFound;
+    FoundCount = 0;
+    for (i = 0; i < DISCOVER_WINDOW; i++) {
+        Slots[i].Busy = false;
+    }
+    memset(Answered, 0, sizeof(Answered));
+    LineFreeAt = micros();
+    SetReadCallback(OnReply);
+
+    while (millis() - start < timeoutMs) {
+        DmmSerialEvent();
+        now = micros();
+        busy = false;
+        for (i = 0; i < DISCOVER_WINDOW; i++) {
+            slot = &Slots[i];
+            if (slot->Busy && (long)(now - slot->Deadline) >= 0) {
+                if (slot->Tries < DISCOVER_TRIES) {
+                    slot->Tries++;
+                    SendStep(slot);
+                } else if (slot->Step == 0) {
+                    slot->Busy = false; // nobody at this ID
+                } else {
+                    NextStep(slot); // leave its Missing bit set
+                }
+            }
+            nextID = Unanswered(nextID);
+            if (!slot->Busy && nextID <= DISCOVER_MAX_ID) {
+                slot->ID = nextID++;
+                slot->Step = 0;
+                slot->Tries = 1;
+                slot->Busy = true;
+                SendStep(slot);
+            }
+            busy |= slot->Busy;
+        }
+        if (!busy && nextID > DISCOVER_MAX_ID) {
+            if (pass == DISCOVER_PASSES || FoundCount == FoundMax) {
+                break;
+            }
+            pass++;
+            nextID = 0;
+        }
+    }
+
+    SetReadCallback(saved);
+    DMM_PRINTF("Discovered %d drive(s) in %lu ms\n", FoundCount, millis() - start);
+    return FoundCount;
+}
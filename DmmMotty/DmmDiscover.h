@@ -0,0 +1,53 @@
+/*
+
+Bus discovery. DiscoverDrives() sends Read_Drive_ID to every ID from 0 to
+DISCOVER_MAX_ID, keeping up to DISCOVER_WINDOW requests in flight. Requests
+queue behind each other on the wire, so each one's DISCOVER_TIMEOUT_US runs
+from when its last byte is expected out at DMM_BAUD_RATE, not from when it
+was handed to the UART. A probe left unanswered is sent once more before
+the ID counts as empty. Drives that answer are asked for their status, gear
+number and config in the same pass, ahead of further probes. A sweep of an
+empty bus takes about 0.6 s at 38400 baud; DISCOVER_PASSES sweeps more over
+the IDs still silent can be asked for on a noisy line.
+
+Replies from several drives can overlap on a shared line; lower the window
+to 1 if replies are lost.
+
+*/
+
+#ifndef DmmDriver_DmmDiscover_h
+#define DmmDriver_DmmDiscover_h
+
+#include "DmmDriver.h"
+
+#define DISCOVER_MAX_ID 127
+
+#ifndef DISCOVER_WINDOW
+    #define DISCOVER_WINDOW 4         // requests in flight
+#endif
+
+#define DISCOVER_FRAME_BYTES 4 // every request: no data beyond one dummy byte
+#define DISCOVER_REPLY_BYTES 6 // longest reply, a gear number
+
+#ifndef DISCOVER_TIMEOUT_US
+    // From the end of a request: turnaround, then its reply, which may queue
+    // behind the replies to the others in flight
+    #define DISCOVER_TIMEOUT_US (DMM_TURNAROUND_US + DISCOVER_WINDOW * DISCOVER_REPLY_BYTES * DMM_BYTE_US)
+#endif
+
+#define DISCOVER_TRIES 2 // per request, probes included
+
+#ifndef DISCOVER_PASSES
+    #define DISCOVER_PASSES 1 // sweeps over the IDs still silent
+#endif
+
+typedef struct {
+    char ID;
+    unsigned char Status, Config;
+    unsigned int GearNumber;
+    unsigned char Missing; // a bit per follow up read left unanswered, 0 when complete
+} DiscoveredDrive_t;
+
+unsigned char DiscoverDrives(DiscoveredDrive_t * found, unsigned char maxFound, unsigned int timeoutMs) ;
+
+#endif // DmmDriver_DmmDiscover_h
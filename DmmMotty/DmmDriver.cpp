@@ -24,6 +24,7 @@ Communication Format
 //#include <sysexits.h>
 //#include <stdio.h>
 #include <limits.h>
+#include <string.h>
 #include "Arduino.h"
 #include "DmmDriver.h"
 
@@ -32,56 +33,79 @@ Communication Format
 #define false 0
 
 
-static char InputBuffer[8]; //Input buffer from RS232,
+static unsigned char InputBuffer[DMM_RX_BUFFER_SIZE]; //Input buffer from RS232,
 static signed int InBfTopPointer = 0,InBfBtmPointer = 0;//input buffer pointers
 static unsigned char Read_Package_Buffer[8], Read_Num, Read_Package_Length;
 long Drive_Read_Value = LONG_MIN;
 unsigned char Drive_Read_Code = -1;
+static char Drive_Read_ID = -1;
 ProtocolError_t ProtocolError = Timeout_Error;
+static ReadCallback_t ReadCallback = 0;
+static Stream * Port = &Serial; // link to the drive(s), see SetDmmPort
+LinkStats_t LinkStats = {0, 0, 0, 0};
+
+// A frame we may need to send again: the last command per axis (in case the
+// drive rejects it with a CRC alarm) and the queries awaiting a reply (in
+// case the reply fails our checksum), found again by ID and the Is_ code
+// they are answered with. Length 0 means the slot is empty.
+typedef struct {
+    char ID;
+    unsigned char Function_Code;
+    unsigned char ReplyCode;
+    unsigned char Length;
+    unsigned char Frame[8];
+    bool Retried;
+} SentFrame_t;
+
+static SentFrame_t SentCommands[DMM_MAX_AXES];
+static SentFrame_t SentQueries[DMM_MAX_QUERIES];
+static unsigned char NextQuerySlot;
+static unsigned char CrcAlarms[16]; // one bit per drive ID showing alarm 4
+
+static void RememberFrame(unsigned char func, char ID, long data, unsigned char Plength, unsigned char B[8]) ;
+static SentFrame_t * FindQuery(char ID, unsigned char code) ;
+static bool Retransmit(SentFrame_t * sent) ;
 
 const char * ParameterName(char isCode) {
     switch(isCode) {
-        case Is_MainGain : return "Main Gain";
-        case Is_SpeedGain : return "Speed Gain";
-        case Is_IntGain : return "Intergration Gain";
-        case Is_Status : return "Status Byte";
-        case Is_Config : return "Config Byte";
-        case Is_PosOn_Range : return "Position On Range";
-        case Is_GearNumber : return "Gear Number";
-        case Is_AbsPos32 : return "Absolute Position";
-        case Is_TrqCons : return "Torque Contant";
-        case Is_HighSpeed : return "Max Speed";
-        case Is_HighAccel : return "Max Acceleration";
-        case Is_Drive_ID : return "Drive ID";
-        default: return "Unknown Parameter";
+        case Is_MainGain : return DMM_STR("Main Gain");
+        case Is_SpeedGain : return DMM_STR("Speed Gain");
+        case Is_IntGain : return DMM_STR("Intergration Gain");
+        case Is_Status : return DMM_STR("Status Byte");
+        case Is_Config : return DMM_STR("Config Byte");
+        case Is_PosOn_Range : return DMM_STR("Position On Range");
+        case Is_GearNumber : return DMM_STR("Gear Number");
+        case Is_AbsPos32 : return DMM_STR("Absolute Position");
+        case Is_TrqCons : return DMM_STR("Torque Contant");
+        case Is_HighSpeed : return DMM_STR("Max Speed");
+        case Is_HighAccel : return DMM_STR("Max Acceleration");
+        case Is_Drive_ID : return DMM_STR("Drive ID");
+        default: return DMM_STR("Unknown Parameter");
     }
 }
 
 
-void ReadPackage() {
-  unsigned char c,cif;
-  if (Serial.available() < 0) { // no new data
-      return;
-      /*
-       delay(50);
-      printf("... \n");
-      if (SerialAvailable() == 0) {
-          ProtocolError = Timeout_Error;
-          printf("Timeout\n");
-          return;
-      }
-      */
-  }
-  while(Serial.available () > 0 && ((InBfTopPointer+1) % sizeof(InputBuffer)) != InBfBtmPointer  ) {
+// Move whatever the UART has received into InputBuffer
+static void FillInputBuffer() {
+  while(Port->available() > 0 && ((InBfTopPointer+1) % sizeof(InputBuffer)) != InBfBtmPointer  ) {
       // while there is data and buffer not full
-    InputBuffer[InBfTopPointer] = Serial.read(); //Load InputBuffer with received packets
+    InputBuffer[InBfTopPointer] = Port->read(); //Load InputBuffer with received packets
     InBfTopPointer++;  InBfTopPointer %=sizeof(InputBuffer);
   }
+}
+
+// Assemble frames from InputBuffer. With stopOnReply set we return as soon as
+// a reply completes, so a blocking read sees its own answer in the globals.
+static void ParseInputBuffer(bool stopOnReply) {
+  unsigned char c,cif;
   while(InBfBtmPointer != InBfTopPointer)  { // while not empty
     c = InputBuffer[InBfBtmPointer];
     InBfBtmPointer++; InBfBtmPointer %=sizeof(InputBuffer);;
     cif = c&0x80; // Start or "End" Frame Char
     if(cif==0) {
+      if (Read_Num > 0) { // new start byte before the last frame was complete
+        LinkStats.Resyncs++;
+      }
       Read_Num = 0;
       Read_Package_Length = 0;
     }
@@ -100,7 +124,7 @@ void ReadPackage() {
         ProtocolError = Get_Function();
         Read_Num = 0;
         Read_Package_Length = 0;
-        if (ProtocolError != In_Progress) {
+        if (stopOnReply && ProtocolError != In_Progress) {
 //            InBfBtmPointer = InBfTopPointer = 0;
             return;
         }
@@ -109,6 +133,49 @@ void ReadPackage() {
   }
 }
 
+void ReadPackage() {
+  if (Port->available() < 0) { // no new data
+      return;
+      /*
+       delay(50);
+      printf("... \n");
+      if (SerialAvailable() == 0) {
+          ProtocolError = Timeout_Error;
+          printf("Timeout\n");
+          return;
+      }
+      */
+  }
+  FillInputBuffer();
+  ParseInputBuffer(true);
+}
+
+// Call from the sketch's serialEvent(). Parses every frame received since the
+// last call and hands each reply to the read callback, without blocking.
+void DmmSerialEvent() {
+  do {
+    FillInputBuffer();
+    ParseInputBuffer(false);
+  } while (Port->available() > 0);
+}
+
+// Talk to the drives over another Stream, e.g. Serial1 or a DmmSimDrive
+void SetDmmPort(Stream * port) {
+  Port = port;
+}
+
+Stream * GetDmmPort() {
+  return Port;
+}
+
+void SetReadCallback(ReadCallback_t callback) {
+  ReadCallback = callback;
+}
+
+ReadCallback_t GetReadCallback() {
+  return ReadCallback;
+}
+
 ProtocolError_t Get_Function(void)
 {
   int i;
@@ -125,87 +192,122 @@ ProtocolError_t Get_Function(void)
   
   if(CRC_Check!= 0){
     //MessageBox(?There is CRC error!?) - Customer code to indicate CRC error
-      printf("CRC Error\n");
+      DMM_PRINTF("CRC Error\n");
+      LinkStats.CrcErrorsRx++;
+      // Only resend when the damaged frame still names a query we sent;
+      // with several queries in flight the last one sent may not be it
+      SentFrame_t * query = FindQuery(ID, ReceivedFunction_Code);
+      if (query) {
+          if (Retransmit(query)) {
+              return In_Progress; // keep waiting for the reply to the resent query
+          }
+          query->Length = 0;
+      }
       return CRC_Error;
   }
+  SentFrame_t * query = FindQuery(ID, ReceivedFunction_Code);
+  if (query) {
+      query->Length = 0; // answered
+  }
+  Drive_Read_ID = ID;
   Drive_Read_Code = (unsigned char)ReceivedFunction_Code;
-  switch(ReceivedFunction_Code) {
-        case Is_AbsPos32:
-        case Is_TrqCurrent:
-        case Is_GearNumber:
-        case Is_Config :
-        case Is_Status :
-            Drive_Read_Value = Cal_SignValue(Read_Package_Buffer);
-            break;
-        case Is_MainGain:
-        case Is_SpeedGain:
-        case Is_IntGain:
-        case Is_TrqCons:
-        case Is_HighSpeed:
-        case Is_HighAccel:
-        case Is_Drive_ID:
-        case Is_PosOn_Range:
-            Drive_Read_Value = Cal_UnsignedValue(Read_Package_Buffer);
-            break;
-        default:
-            Drive_Read_Value = Cal_SignValue(Read_Package_Buffer);
+  if (IsUnsignedParameter(Drive_Read_Code)) {
+      Drive_Read_Value = Cal_UnsignedValue(Read_Package_Buffer);
+  } else {
+      Drive_Read_Value = Cal_SignValue(Read_Package_Buffer);
+  }
+  DMM_PRINTF(DMM_STR_FMT ": %ld\n",ParameterName(Drive_Read_Code), Drive_Read_Value);
+  if (ReadCallback) {
+      ReadCallback(ID, Drive_Read_Code, Drive_Read_Value);
+  }
+  if (Drive_Read_Code == Is_Status) {
+      unsigned char bit = 1 << (ID & 7);
+      if (((Drive_Read_Value & 28) >> 2) != 4) {
+          CrcAlarms[ID >> 3] &= ~bit;
+      } else if (!(CrcAlarms[ID >> 3] & bit)) {
+          // Alarm 4 just came on: the drive rejected our last command on its
+          // checksum. It stays set over later status reads, so act only once.
+          CrcAlarms[ID >> 3] |= bit;
+          LinkStats.CrcErrorsTx++;
+          SentFrame_t * sent = &SentCommands[(unsigned char)ID % DMM_MAX_AXES];
+          if (sent->Length && sent->ID == ID) {
+              Retransmit(sent);
+          }
+      }
   }
-  printf("%s: %ld\n",ParameterName(Drive_Read_Code), Drive_Read_Value);
   return Complete_Success;
 }
 
 bool printStatusByte(unsigned char statusByte) {
     bool FatalError = false;
-    printf("Motor Status\n");
+    DMM_PRINTF("Motor Status\n");
     if (statusByte & 1) { // bit 0
-        printf("\tMotor In position\n");
+        DMM_PRINTF("\tMotor In position\n");
     } else {
-        printf("\tMotor Out of Position\n");
+        DMM_PRINTF("\tMotor Out of Position\n");
     }
     
     if (statusByte & 2) { // bit 1
-        printf("\tMotor Free/Disengaged\n");
+        DMM_PRINTF("\tMotor Free/Disengaged\n");
     } else {
-        printf("\tMotor Active/Enagaged\n");
+        DMM_PRINTF("\tMotor Active/Enagaged\n");
     }
     
     if (statusByte & 28) { // bits 2,3,4
-        printf("\tALARM: ");
+        DMM_PRINTF("\tALARM: ");
         int alarmCode = (statusByte & 28) >> 2;
         switch (alarmCode) {
             case 1:
-                printf("Lost Phase, |Pset - Pmotor|>8192(steps), 180(deg)\n");
+                DMM_PRINTF("Lost Phase, |Pset - Pmotor|>8192(steps), 180(deg)\n");
                 FatalError = true;
                 break;
             case 2:
-                printf("Over Current\n");
+                DMM_PRINTF("Over Current\n");
                 FatalError = true;
                 break;
             case 3:
-                printf("Over Heat or Over Power\n");
+                DMM_PRINTF("Over Heat or Over Power\n");
                 FatalError = true;
                 break;
             case 4:
-                printf("CRC Error Report, Command not Accepted\n");
+                DMM_PRINTF("CRC Error Report, Command not Accepted\n");
                 break;
             default:
-                printf("Unkown Error\n");
+                DMM_PRINTF("Unkown Error\n");
         }
     } else {
         //printf("No Alarm");
     }
     
     if ((statusByte & 32) == 0) { // bit 5
-        printf("\tWaiting for next S-curve,lieanr,circular motion\n");
+        DMM_PRINTF("\tWaiting for next S-curve,lieanr,circular motion\n");
     } else {
-        printf("\tBUSY with current S-curve,lieanr,circular motion\n");
+        DMM_PRINTF("\tBUSY with current S-curve,lieanr,circular motion\n");
     }
     
     bool pin2JP3 = (statusByte & 64);  // bit 6
-    printf("\tCNC Zero Position (PIN 2 of JP3): %s\n", (pin2JP3) ? "HIGH" : "LOW");
+    DMM_PRINTF("\tCNC Zero Position (PIN 2 of JP3): " DMM_STR_FMT "\n", (pin2JP3) ? DMM_STR("HIGH") : DMM_STR("LOW"));
+    (void)pin2JP3;
     return FatalError;
 }
 
+// Which Is_ codes carry unsigned data; everything else is signed
+bool IsUnsignedParameter(unsigned char isCode) {
+    switch(isCode) {
+        case Is_MainGain:
+        case Is_SpeedGain:
+        case Is_IntGain:
+        case Is_TrqCons:
+        case Is_HighSpeed:
+        case Is_HighAccel:
+        case Is_Drive_ID:
+        case Is_PosOn_Range:
+            return true;
+        default: // Is_AbsPos32, Is_TrqCurrent, Is_GearNumber, Is_Config, Is_Status
+            return false;
+    }
+}
+
 /*Get data with sign - long*/
 long Cal_SignValue(unsigned char One_Package[8])
 {
@@ -217,7 +319,7 @@ long Cal_SignValue(unsigned char One_Package[8])
   Package_Length = 4 + OneChar;
   OneChar = One_Package[2]; /*First byte 0x7f, bit 6 reprents sign */
   OneChar = OneChar << 1;
-  Lcmd = (long)OneChar; /* Sign extended to 32bits */
+  Lcmd = (long)(signed char)OneChar; /* Sign extended to 32bits, also where char is unsigned (ARM) */
   Lcmd = Lcmd >> 1;
   for(i=3;i<Package_Length-1;i++)
   {
@@ -258,11 +360,15 @@ unsigned int Cal_UnsignedValue(unsigned char One_Package[8])
 // always B0, but in the code of below, the first byte is always B0.
 //
 
-void Send_Package(unsigned char func, char ID , long Displacement)
+// Build a package into B, checksum included, and return its length.
+// Send_Package and the batch encoder (DmmBatch.cpp) share this as the
+// reference for the frame layout.
+unsigned char Encode_Package(unsigned char func, char ID , long Displacement, unsigned char B[8])
 {
     
-  unsigned char B[8],Package_Length,Function_Code;
+  unsigned char Package_Length,Function_Code,Error_Check;
   long TempLong;
+  int i;
   B[1] = B[2] = B[3] = B[4] = B[5] = (unsigned char)0x80;
   B[0] = ID&0x7f;
   Function_Code = func & 0x1f;
@@ -275,9 +381,11 @@ void Send_Package(unsigned char func, char ID , long Displacement)
   TempLong = TempLong>>7;
   B[2] += (unsigned char)TempLong&0x0000007f;
   Package_Length = 7;
+  // Compare against -1 rather than 0xffffffff so negative values also get
+  // the short forms where long is 64 bits (host builds)
   TempLong = Displacement;
   TempLong = TempLong >> 20;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0) || ( TempLong == -1))
   {//Three byte data
     B[2] = B[3];
     B[3] = B[4];
@@ -286,7 +394,7 @@ void Send_Package(unsigned char func, char ID , long Displacement)
   }
   TempLong = Displacement;
   TempLong = TempLong >> 13;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0) || ( TempLong == -1))
   {//Two byte data
     B[2] = B[3];
     B[3] = B[4];
@@ -294,13 +402,100 @@ void Send_Package(unsigned char func, char ID , long Displacement)
   }
   TempLong = Displacement;
   TempLong = TempLong >> 6;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0) || ( TempLong == -1))
   {//One byte data
     B[2] = B[3];
     Package_Length = 4;
   }
   B[1] += (Package_Length-4)*32 + Function_Code;
+  Error_Check = 0;
+  for(i=0;i<Package_Length-1;i++) {
+    Error_Check += B[i];
+  }
+  B[Package_Length-1] = Error_Check|0x80;
+  return Package_Length;
+}
+
+// Returns the bytes sent, for callers pacing the link
+unsigned char Send_Package(unsigned char func, char ID , long Displacement)
+{
+  unsigned char B[8],Package_Length;
+  Package_Length = Encode_Package(func, ID, Displacement, B);
+  RememberFrame(func & 0x1f, ID, Displacement, Package_Length, B);
   Make_CRC_Send(Package_Length,B);
+  return Package_Length;
+}
+
+// The Is_ code a drive answers func with, 0 for a command without a reply
+unsigned char ReplyCodeOf(unsigned char func, long data) {
+    switch(func & 0x1f) {
+        case General_Read: return data & 0x1f;
+        case Read_MainGain: return Is_MainGain;
+        case Read_SpeedGain: return Is_SpeedGain;
+        case Read_IntGain: return Is_IntGain;
+        case Read_TrqCons: return Is_TrqCons;
+        case Read_HighSpeed: return Is_HighSpeed;
+        case Read_HighAccel: return Is_HighAccel;
+        case Read_Drive_Config: return Is_Config;
+        case Read_Drive_Status: return Is_Status;
+        case Read_Pos_OnRange: return Is_PosOn_Range;
+        case Read_GearNumber: return Is_GearNumber;
+        case Read_Drive_ID: return Is_Drive_ID;
+        default: return 0;
+    }
+}
+
+// Keep a copy of an outgoing frame so it can be resent once
+static void RememberFrame(unsigned char func, char ID, long data, unsigned char Plength, unsigned char B[8]) {
+    SentFrame_t * sent;
+    unsigned char code = ReplyCodeOf(func, data), i;
+    if (code) {
+        // Same question again, else a free slot, else the oldest
+        sent = FindQuery(ID, code);
+        for (i = 0; sent == NULL && i < DMM_MAX_QUERIES; i++) {
+            if (SentQueries[i].Length == 0) {
+                sent = &SentQueries[i];
+            }
+        }
+        if (sent == NULL) {
+            sent = &SentQueries[NextQuerySlot];
+            NextQuerySlot = (NextQuerySlot + 1) % DMM_MAX_QUERIES;
+        }
+    } else {
+        sent = &SentCommands[(unsigned char)ID % DMM_MAX_AXES];
+    }
+    sent->ID = ID;
+    sent->Function_Code = func;
+    sent->ReplyCode = code;
+    sent->Length = Plength;
+    memcpy(sent->Frame, B, Plength);
+    sent->Retried = false;
+}
+
+// The query awaiting a reply from ID with the given Is_ code, if any
+static SentFrame_t * FindQuery(char ID, unsigned char code) {
+    unsigned char i;
+    for (i = 0; i < DMM_MAX_QUERIES; i++) {
+        if (SentQueries[i].Length && SentQueries[i].ID == ID && SentQueries[i].ReplyCode == code) {
+            return &SentQueries[i];
+        }
+    }
+    return NULL;
+}
+
+// Resend a remembered frame, at most once per original send
+static bool Retransmit(SentFrame_t * sent) {
+    if (sent->Retried) {
+        return false;
+    }
+    sent->Retried = true;
+    LinkStats.Retransmits++;
+    Make_CRC_Send(sent->Length, sent->Frame);
+    return true;
+}
+
+void ResetLinkStats() {
+    memset(&LinkStats, 0, sizeof(LinkStats));
 }
 
 
@@ -308,11 +503,11 @@ void Make_CRC_Send(unsigned char Plength,unsigned char B[8]) {
   unsigned char Error_Check = 0;
   int i;
   for(i=0;i<Plength-1;i++) {
-    Serial.write(B[i]);
+    Port->write(B[i]);
     Error_Check += B[i];
   }
   Error_Check = Error_Check|0x80;
-  Serial.write(Error_Check);
+  Port->write(Error_Check);
 }
 
 
@@ -339,8 +534,9 @@ void MoveMotorToAbsolutePosition32(char Axis_Num,long Pos32) {
 }
 
 void MoveMotorConstantRotation(char Axis_Num,long r) {
-// TODO set Limits for 3 byte value of r
-    Send_Package(Turn_ConstSpeed, Axis_Num, r);
+    // Turn_ConstSpeed takes at most 3 data bytes
+    long l = MAX(CONST_SPEED_MIN, MIN(CONST_SPEED_MAX, r));
+    Send_Package(Turn_ConstSpeed, Axis_Num, l);
 }
 
 void ResetOrgin(char Axis_Num) {
@@ -398,7 +594,7 @@ long ReadParamer(char queryParam, char Axis_Num) {
         ReadPackage();
         delay(20);
     }
-//    printf("%s: %ld\n",ParameterName(Drive_Read_Code), Drive_Read_Value);
+//    DMM_PRINTF(DMM_STR_FMT ": %ld\n",ParameterName(Drive_Read_Code), Drive_Read_Value);
     if (ProtocolError == Complete_Success) {
         return Drive_Read_Value;
     } else {
@@ -406,6 +602,40 @@ long ReadParamer(char queryParam, char Axis_Num) {
     }
 }
 
+// Send a query and wait at most timeoutMs for its reply. Unlike ReadParamer
+// this never hangs on a missing drive: ProtocolError is left at Timeout_Error
+// and LONG_MIN returned. Replies from another drive or with another Is_ code,
+// such as a late answer to a query that already timed out, are skipped.
+long QueryDrive(unsigned char func, char Axis_Num, long data, unsigned int timeoutMs) {
+    unsigned long start = millis();
+    unsigned char code = ReplyCodeOf(func, data);
+    ProtocolError = In_Progress;
+    Send_Package(func, Axis_Num, data);
+    while(ProtocolError == In_Progress) {
+        ReadPackage();
+        if (ProtocolError == Complete_Success && (Drive_Read_ID != (Axis_Num & 0x7f) || Drive_Read_Code != code)) {
+            ProtocolError = In_Progress; // stale, not ours
+        }
+        if (millis() - start >= timeoutMs) {
+            ProtocolError = Timeout_Error;
+        }
+    }
+    if (ProtocolError == Complete_Success) {
+        return Drive_Read_Value;
+    } else {
+        return LONG_MIN;
+    }
+}
+
+// Ask for a parameter without waiting; the reply arrives via the read callback
+void RequestParameter(char queryParam, char Axis_Num) {
+    Send_Package(queryParam, Axis_Num, 0 ); // 0 is a dummy Data Value
+}
+
+void RequestMotorPosition32(char AxisID) {
+    Send_Package(General_Read, AxisID , Is_AbsPos32);
+}
+
 void ReadMotorPosition32(char AxisID)
 { // Below are the codes for reading the motor shaft 32bits absolute position
     //Read motor 32bits position
@@ -419,4 +649,22 @@ void ReadMotorPosition32(char AxisID)
     }
 }
 
-
+#ifdef __AVR__
+extern char __heap_start, *__brkval, __data_load_end;
+#endif
+
+// Report the SRAM held by the driver's own buffers and, on AVR, the free SRAM
+// and flash used by the whole sketch, to compare DmmConfig.h profiles. Goes
+// to stdout like the diagnostics, but is kept when they are compiled out.
+void PrintMemoryUsage() {
+    unsigned int driverRam = sizeof(InputBuffer) + sizeof(Read_Package_Buffer)
+        + sizeof(SentCommands) + sizeof(SentQueries) + sizeof(CrcAlarms) + sizeof(LinkStats);
+    DMM_REPORTF("Driver SRAM: %u bytes (diagnostics %d, low footprint %d)\n",
+                driverRam, DMM_DIAGNOSTICS, DMM_LOW_FOOTPRINT);
+#ifdef __AVR__
+    char top;
+    unsigned int freeRam = &top - (__brkval ? __brkval : &__heap_start);
+    DMM_REPORTF("Free SRAM: %u bytes, Flash used: %u bytes\n",
+                freeRam, (unsigned int)&__data_load_end);
+#endif
+}
@@ -25,9 +25,14 @@ Communication Format
 
 */
 
+#ifndef DmmDriver_DmmDriver_h
+#define DmmDriver_DmmDriver_h
+
 //#include <sysexits.h>
 //#include <stdio.h>
 #include <limits.h>
+#include "Arduino.h"
+#include "DmmConfig.h"
 
 #define bool unsigned short
 #define true 1
@@ -36,11 +41,16 @@ Communication Format
 #define Go_Absolute_Pos 0x01
 #define Turn_ConstSpeed 0x0a
 #define Set_Origin 0x00
+#define CONST_SPEED_MIN (-1048576L) // Turn_ConstSpeed range, 3 data bytes: -2^20 ~ 2^20 - 1
+#define CONST_SPEED_MAX 1048575L
 #define Set_HighSpeed 0x14
 #define Set_HighAccel 0x15
 #define Set_MainGain  0x10
 #define Set_SpeedGain 0x11
 #define Set_IntGain  0x12
+#define Set_TrqCons 0x13
+#define Set_Pos_OnRange 0x16
+#define Set_GearNumber 0x17
 
 
 #define Set_Drive_Config 0x07
@@ -65,6 +75,9 @@ Communication Format
 #define Read_MainGain 0x18
 #define Read_SpeedGain 0x19
 #define Read_IntGain 0x1a
+#define Read_TrqCons 0x1b
+#define Read_HighSpeed 0x1c
+#define Read_HighAccel 0x1d
 #define Read_Drive_Config 0x08
 #define Read_Drive_Status 0x09
 #define Read_Pos_OnRange 0x1e
@@ -81,16 +94,35 @@ Communication Format
 
 typedef enum {In_Progress = 0, Complete_Success,  CRC_Error, Timeout_Error } ProtocolError_t;
 
-ProtocolError_t Get_Function(void) ;
-long Cal_SignValue(unsigned char One_Package[8]) ;
-unsigned int Cal_UnsignedValue(unsigned char One_Package[8]) ;
-void Make_CRC_Send(unsigned char Plength,unsigned char B[8]) ;
+// Link health counters, so noisy cabling shows up as numbers
+typedef struct {
+    unsigned int CrcErrorsRx; // replies from the drive failing our checksum
+    unsigned int CrcErrorsTx; // commands the drive reported as CRC rejected (alarm 4)
+    unsigned int Resyncs;     // partial frames dropped when a new start byte arrived
+    unsigned int Retransmits; // frames sent a second time
+} LinkStats_t;
+
+extern LinkStats_t LinkStats;
+void ResetLinkStats() ;
+
+// Called for every reply parsed, with the replying axis, its Is_ code and value
+typedef void (*ReadCallback_t)(char ID, unsigned char code, long value);
+void SetReadCallback(ReadCallback_t callback) ;
+ReadCallback_t GetReadCallback() ;
+void DmmSerialEvent() ;
+void SetDmmPort(Stream * port) ;
+Stream * GetDmmPort() ;
+
 void ReadPackage() ;
 ProtocolError_t Get_Function(void) ;
 bool printStatusByte(unsigned char statusByte) ;
+bool IsUnsignedParameter(unsigned char isCode) ;
+unsigned char ReplyCodeOf(unsigned char func, long data) ;
+const char * ParameterName(char isCode) ;
 long Cal_SignValue(unsigned char One_Package[8] );
 unsigned int Cal_UnsignedValue(unsigned char One_Package[8]) ;
-void Send_Package(unsigned char func, char ID , long Displacement) ;
+unsigned char Encode_Package(unsigned char func, char ID , long Displacement, unsigned char B[8]) ;
+unsigned char Send_Package(unsigned char func, char ID , long Displacement) ;
 void Make_CRC_Send(unsigned char Plength,unsigned char B[8]) ;
 void MoveMotorToAbsolutePosition32(char Axis_Num,long Pos32) ;
 void MoveMotorConstantRotation(char Axis_Num,long r) ;
@@ -105,4 +137,9 @@ void MotorEngage( char Axis_Num, unsigned char curConfig) ;
 void ReadMainGain(char Axis_Num) ;
 long ReadParamer(char queryParam, char Axis_Num) ;
 void ReadMotorPosition32(char AxisID);
+long QueryDrive(unsigned char func, char Axis_Num, long data, unsigned int timeoutMs) ;
+void RequestParameter(char queryParam, char Axis_Num) ;
+void RequestMotorPosition32(char AxisID) ;
+void PrintMemoryUsage() ;
 
+#endif // DmmDriver_DmmDriver_h
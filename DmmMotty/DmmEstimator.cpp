@@ -0,0 +1,145 @@
+#include <math.h>
+#include "Arduino.h"
+#include "DmmEstimator.h"
+
+#define EST_ACCEL_NOISE 0.5f    // of MaxAccel, while the profile accelerates or is unknown
+#define EST_SETTLE_MS 150       // the servo may still overshoot this long after the profile lands
+#define EST_STEADY_NOISE 0.02f  // of MaxAccel, while holding or cruising
+#define EST_SAMPLE_NOISE 2.0f   // counts
+#define EST_SAMPLE_LATENCY 0.002f // s between the drive reading the encoder and the reply
+
+void EstimatorInit(PositionEstimator_t * est, char Axis_Num, float maxSpeed, float maxAccel) {
+    est->Axis = Axis_Num;
+    est->Base = 0;
+    est->Position = est->Velocity = 0;
+    est->Ppp = 1e12f; // unknown until the first sample
+    est->Ppv = 0;
+    est->Pvv = maxSpeed * maxSpeed;
+    est->MaxSpeed = maxSpeed;
+    est->MaxAccel = maxAccel;
+    est->Target = 0;
+    est->Tracking = false;
+    est->Settle = 0;
+    est->Time = micros();
+    est->Pending = false;
+    est->Reads = est->Estimates = 0;
+}
+
+// Acceleration of the drive's trapezoidal profile towards Target
+static float ProfileAccel(const PositionEstimator_t * est, float dt) {
+    float d = (float)(est->Target - est->Base) - est->Position;
+    float v = est->Velocity;
+    float dir = (d >= 0) ? 1 : -1;
+
+    if (v * dir < 0) {
+        return dir * est->MaxAccel; // heading away, turn round
+    }
+    if (v * v >= 2 * est->MaxAccel * fabsf(d)) {
+        return (d != 0) ? -v * v / (2 * d) : 0; // braking onto the target
+    }
+    return dir * MIN(est->MaxAccel, (est->MaxSpeed - fabsf(v)) / dt);
+}
+
+// Run the model forward to now
+static void Predict(PositionEstimator_t * est, unsigned long now) {
+    float left = (now - est->Time) / 1e6f, dt, u, q, d, side;
+    est->Time = now;
+
+    while (left > 0) {
+        // Short steps only while the profile is moving; holding or a constant
+        // velocity is exact in one step however long
+        if (est->Tracking && (est->Velocity != 0 || est->Settle > 0
+                              || est->Target - est->Base != lroundf(est->Position))) {
+            dt = MIN(left, EST_STEP_MS / 1000.0f);
+        } else {
+            dt = left;
+        }
+        left -= dt;
+        u = est->Tracking ? ProfileAccel(est, dt) : 0;
+        q = (!est->Tracking || fabsf(u) > 1e-3f || est->Settle > 0) ? EST_ACCEL_NOISE : EST_STEADY_NOISE;
+        est->Settle = MAX(0, est->Settle - dt);
+        q = q * est->MaxAccel;
+        q = q * q;
+
+        d = (float)(est->Target - est->Base) - est->Position;
+        est->Position += est->Velocity * dt + 0.5f * u * dt * dt;
+        est->Velocity += u * dt;
+        est->Velocity = MAX(-est->MaxSpeed, MIN(est->MaxSpeed, est->Velocity));
+        if (est->Tracking && est->Velocity != 0) {
+            // Landed when close, or when the step would have crossed the target
+            side = (d >= 0) ? 1 : -1;
+            if (side * ((float)(est->Target - est->Base) - est->Position) < 0.5f) {
+                est->Position = (float)(est->Target - est->Base); // landed
+                est->Velocity = 0;
+                est->Settle = EST_SETTLE_MS / 1000.0f;
+            }
+        }
+
+        // P = F P F' + Q for the constant acceleration step
+        est->Ppp += dt * (2 * est->Ppv + dt * est->Pvv) + q * dt * dt * dt / 3;
+        est->Ppv += dt * est->Pvv + q * dt * dt / 2;
+        est->Pvv += q * dt;
+    }
+}
+
+// Go_Absolute_Pos, remembered as the profile's target
+void EstimatorMoveTo(PositionEstimator_t * est, long Pos32) {
+    Predict(est, micros());
+    MoveMotorToAbsolutePosition32(est->Axis, Pos32);
+    est->Target = Pos32;
+    est->Tracking = true;
+}
+
+// The axis is driven some other way (Turn_ConstSpeed, by hand): carry on at
+// the current velocity and let the bound grow faster
+void EstimatorFree(PositionEstimator_t * est) {
+    Predict(est, micros());
+    est->Tracking = false;
+}
+
+// Feed an Is_AbsPos32 reply, e.g. from the read callback
+void EstimatorSample(PositionEstimator_t * est, long Pos32) {
+    float r, s, kp, kv, y, lag;
+    long shift;
+
+    Predict(est, micros());
+    lag = est->Velocity * EST_SAMPLE_LATENCY;
+    r = EST_SAMPLE_NOISE * EST_SAMPLE_NOISE + lag * lag;
+    s = est->Ppp + r;
+    kp = est->Ppp / s;
+    kv = est->Ppv / s;
+    y = (float)(Pos32 - est->Base) - est->Position;
+
+    est->Position += kp * y;
+    est->Velocity += kv * y;
+    est->Pvv -= kv * est->Ppv;
+    est->Ppv *= 1 - kp;
+    est->Ppp *= 1 - kp;
+
+    shift = lroundf(est->Position);
+    est->Base += shift;
+    est->Position -= shift;
+    est->Pending = false;
+}
+
+// Position from the model, with its bound in counts. Sends a read when the
+// bound is wider than tolerance and no read is already on its way; the
+// reply has to be passed to EstimatorSample().
+long EstimatePosition(PositionEstimator_t * est, long tolerance, long * bound) {
+    unsigned long now = millis();
+    float b;
+
+    Predict(est, micros());
+    est->Estimates++;
+    b = 3 * sqrtf(est->Ppp);
+    if (b > tolerance && (!est->Pending || now - est->RequestedAt >= EST_READ_TIMEOUT)) {
+        RequestMotorPosition32(est->Axis);
+        est->Pending = true;
+        est->RequestedAt = now;
+        est->Reads++;
+    }
+    if (bound) {
+        *bound = (b < LONG_MAX) ? (long)ceilf(b) : LONG_MAX;
+    }
+    return est->Base + lroundf(est->Position);
+}
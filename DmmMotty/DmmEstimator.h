@@ -0,0 +1,45 @@
+/*
+
+Position estimator. Rather than polling Is_AbsPos32 to know where an axis
+is, ask EstimatePosition() with the accuracy needed. Each axis runs a
+small Kalman filter (position and velocity) driven by the drive's own
+profile: the target of the last Go_Absolute_Pos sent through
+EstimatorMoveTo() and the speed/acceleration limits given to
+SetMaxSpeed/SetMaxAccel, converted to counts/s and counts/s^2. Replies
+fed to EstimatorSample() correct it. The estimate comes with a 3 sigma
+bound, and a General_Read of Is_AbsPos32 is sent only when that bound is
+wider than the caller's tolerance, so a resting or cruising axis costs
+almost no link time.
+
+*/
+
+#ifndef DmmDriver_DmmEstimator_h
+#define DmmDriver_DmmEstimator_h
+
+#include "DmmDriver.h"
+
+#define EST_READ_TIMEOUT 50   // ms before an unanswered read is asked again
+#define EST_STEP_MS 5         // prediction step, short enough to follow the profile's phases
+
+typedef struct {
+    char Axis;
+    long Base;                    // Position is kept relative to this so floats stay exact
+    float Position, Velocity;     // counts, counts/s
+    float Ppp, Ppv, Pvv;          // covariance
+    float MaxSpeed, MaxAccel;     // the drive's profile limits
+    long Target;
+    bool Tracking;                // following a Go_Absolute_Pos to Target
+    float Settle;                 // s left before a landed profile counts as holding
+    unsigned long Time;           // micros() of the estimate
+    unsigned long RequestedAt;    // millis() of the read in flight
+    bool Pending;
+    unsigned long Reads, Estimates; // bus reads sent, queries answered
+} PositionEstimator_t;
+
+void EstimatorInit(PositionEstimator_t * est, char Axis_Num, float maxSpeed, float maxAccel) ;
+void EstimatorMoveTo(PositionEstimator_t * est, long Pos32) ;
+void EstimatorFree(PositionEstimator_t * est) ;
+void EstimatorSample(PositionEstimator_t * est, long Pos32) ;
+long EstimatePosition(PositionEstimator_t * est, long tolerance, long * bound) ;
+
+#endif // DmmDriver_DmmEstimator_h
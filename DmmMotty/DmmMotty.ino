@@ -1,51 +1,188 @@
 #include "DmmDriver.h"
+#include "DmmSim.h"
+#include "DmmTune.h"
+#include "DmmBench.h"
+#include "DmmRamp.h"
+#include "DmmPlanner.h"
+#include "DmmDiscover.h"
+
+#define USE_SIMULATED_DRIVE false // talk to a DmmSimDrive instead of the real drive
+#define AUTOTUNE false            // search for gains in setup() instead of setting them by hand
+#define MOTION_BENCHMARK false    // measure each SetMaxSpeed/SetMaxAccel pair in setup()
+#define DISCOVER_BUS false        // list the drives on the link in setup()
+
+#if USE_SIMULATED_DRIVE
+DmmSimDrive simDrive;
+#endif
 
 unsigned char statusByte = -1;
 unsigned char configByte = -1;
 const char Axis_Num = 0;
+unsigned char maxAccel = 1;
+long motorPosition = 0;
 
-void setup() {
-  Serial.begin(38400);
-  delay(1000);
-  //SetMainGain(Axis_Num, 1); // Gain Relative to position off Desitination
-  //SetIntGain(Axis_Num, 1); // higher for rigid system, lower for loose system (outside disturbance)
-                             // lag in feedback from encoder
-                             
-  //SetSpeedGain(Axis_Num, 127); // [127] higher : less dynamic movements
-  SetMaxSpeed(Axis_Num, 1); 
-  SetMaxAccel(Axis_Num, 1);
-}
+// Cooperative tasks: loop() never blocks, each task runs when its period
+// has elapsed on millis(), and replies are parsed in serialEvent().
+typedef struct {
+    unsigned long period; // ms
+    unsigned long last;
+    void (*run)();
+} Task_t;
 
+void onDriveRead(char ID, unsigned char code, long value) {
+    if (ID != Axis_Num) return;
+    switch (code) {
+        case Is_AbsPos32: motorPosition = value; break;
+        case Is_Status: statusByte = value; break;
+        case Is_Config: configByte = value; break;
+    }
+}
 
-void loop() {  
+void sendLimits() {
    // these next 2 parameters are not remembered on power reset
    // so we just send them all the time.
     SetMaxSpeed(Axis_Num, 1);
-    SetMaxAccel(Axis_Num, 1);
+    SetMaxAccel(Axis_Num, maxAccel);
+}
+
+void pollPosition() {
+    RequestMotorPosition32(Axis_Num);
+}
 
 #if true // Rotation Test
-    MoveMotorConstantRotation(Axis_Num,-10);
-    delay(2000);
-    MoveMotorConstantRotation(Axis_Num,+10);
-    delay(2000);
+void motionTest() {
+    static bool forward = false;
+    MoveMotorConstantRotation(Axis_Num, forward ? +10 : -10);
+    forward = !forward;
+}
+const unsigned long motionPeriod = 2000;
+#endif
+
+#if false // Smooth Rotation Test, S-curve reversals streamed from here
+SpeedRamp_t ramp;
+void motionTest() {
+    static bool forward = false;
+    static unsigned long lastReverse = 0;
+    if (maxAccel != 127) { // let the drive follow the ramp
+        maxAccel = 127;
+        SpeedRampInit(&ramp, Axis_Num, 40, 200, 10);
+    }
+    if (millis() - lastReverse >= 2000) {
+        lastReverse = millis();
+        SpeedRampSetTarget(&ramp, forward ? +10 : -10);
+        forward = !forward;
+    }
+    SpeedRampUpdate(&ramp);
+}
+const unsigned long motionPeriod = 0;
 #endif
-    
 
 #if false // Abs Pos Test
-    MoveMotorToAbsolutePosition32(Axis_Num, -500);
-    delay(2000);
-    MoveMotorToAbsolutePosition32(Axis_Num, 500);    
-    delay(2000);
+void motionTest() {
+    static bool forward = false;
+    MoveMotorToAbsolutePosition32(Axis_Num, forward ? 500 : -500);
+    forward = !forward;
+}
+const unsigned long motionPeriod = 2000;
 #endif
 
 #if false // Rapid Command Test
-    for(long p = 0; p < 1000; p++)  {
-      MoveMotorToAbsolutePosition32(Axis_Num, p);    
+void motionTest() {
+    static long p = 0;
+    static long step = 1;
+    static unsigned long pauseStart = 0;
+    if (pauseStart) { // dwell 1s at either end
+        if (millis() - pauseStart < 1000) return;
+        pauseStart = 0;
     }
-    delay(1000);
-    for(long p = 1000; p > 0; p--)  {
-      MoveMotorToAbsolutePosition32(Axis_Num, p);    
+    MoveMotorToAbsolutePosition32(Axis_Num, p);
+    p += step;
+    if (p == 1000 || p == 0) {
+        step = -step;
+        pauseStart = millis();
     }
-    delay(1000);
+}
+const unsigned long motionPeriod = 0; // as fast as loop() comes round
 #endif
+
+#if false // Path Test, a square traced by Axis_Num and the next drive with blended corners
+Planner_t planner;
+void motionTest() {
+    static const long corners[][2] = { { 0, 0 }, { 10000, 0 }, { 10000, 10000 }, { 0, 10000 } };
+    static unsigned char next = 0;
+    static bool started = false;
+    if (!started) {
+        PlannerConfig_t config;
+        const long start[2] = { 0, 0 };
+        DefaultPlannerConfig(&config, 2);
+        config.Axis[0] = Axis_Num;
+        config.Axis[1] = Axis_Num + 1;
+        config.MaxSpeed[0] = config.MaxSpeed[1] = 800; // under SetMaxSpeed(1) of sendLimits()
+        PlannerInit(&planner, &config, start);
+        maxAccel = 127; // let the drives follow the stream
+        started = true;
+    }
+    while (PlannerAddWaypoint(&planner, corners[next])) {
+        next = (next + 1) % 4;
+    }
+    PlannerUpdate(&planner);
+}
+const unsigned long motionPeriod = 0;
+#endif
+
+Task_t tasks[] = {
+    { 2000, 0, sendLimits },
+    { motionPeriod, 0, motionTest },
+    { 100, 0, pollPosition },
+};
+
+void setup() {
+  Serial.begin(38400);
+  delay(1000);
+#if USE_SIMULATED_DRIVE
+  simDrive.AddAxis(Axis_Num);
+  SetDmmPort(&simDrive);
+#endif
+#if DISCOVER_BUS
+  DiscoveredDrive_t drives[8];
+  unsigned char count = DiscoverDrives(drives, 8, 1000);
+  for (unsigned char i = 0; i < count; i++) {
+    DMM_PRINTF("Drive %d: gear %d, config %d%s\n", drives[i].ID, drives[i].GearNumber,
+               drives[i].Config, drives[i].Missing ? " (incomplete)" : "");
+  }
+#endif
+#if AUTOTUNE
+  TuneConfig_t tuneConfig;
+  Gains_t gains;
+  DefaultTuneConfig(&tuneConfig);
+  AutoTune(Axis_Num, &tuneConfig, &gains); // leaves the best gains set on the drive
+#endif
+#if MOTION_BENCHMARK
+  const unsigned char limits[] = { 1, 5, 20, 60, 127 };
+  for (unsigned char i = 0; i < sizeof(limits); i++) {
+    RunMotionBenchmark(Axis_Num, limits[i], limits[i]);
+  }
+#endif
+  SetReadCallback(onDriveRead);
+  //SetMainGain(Axis_Num, 1); // Gain Relative to position off Desitination
+  //SetIntGain(Axis_Num, 1); // higher for rigid system, lower for loose system (outside disturbance)
+                             // lag in feedback from encoder
+                             
+  //SetSpeedGain(Axis_Num, 127); // [127] higher : less dynamic movements
+  SetMaxSpeed(Axis_Num, 1); 
+  SetMaxAccel(Axis_Num, 1);
+}
+
+void serialEvent() {
+    DmmSerialEvent();
+}
+
+void loop() {  
+    unsigned long now = millis();
+    for (unsigned char i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+        if (now - tasks[i].last >= tasks[i].period) {
+            tasks[i].last = now;
+            tasks[i].run();
+        }
+    }
 }
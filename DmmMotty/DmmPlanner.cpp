@@ -0,0 +1,204 @@
+#include <math.h>
+#include "Arduino.h"
+#include "DmmPlanner.h"
+
+#define PLANNER_FRAME_BYTES 7  // longest Go_Absolute_Pos frame
+#define PLANNER_MIN_LENGTH 0.5f // counts, shorter waypoints are merged into the next
+
+void DefaultPlannerConfig(PlannerConfig_t * config, unsigned char axes) {
+    unsigned char i;
+    config->Axes = MIN(axes, PLANNER_AXES);
+    for (i = 0; i < PLANNER_AXES; i++) {
+        config->Axis[i] = i;
+        config->MaxSpeed[i] = 20000;
+        config->MaxAccel[i] = 100000;
+    }
+    config->BlendTolerance = 10;
+    config->PeriodMs = 10;
+    config->BusBytesPerSecond = BUS_BYTES_PER_SECOND;
+}
+
+void PlannerInit(Planner_t * planner, const PlannerConfig_t * config, const long * start) {
+    unsigned int minPeriod;
+    unsigned char i;
+
+    planner->Config = *config;
+    planner->Config.Axes = MAX(1, MIN(config->Axes, PLANNER_AXES));
+    // One full set of setpoints has to go out within a period
+    minPeriod = ((unsigned long)planner->Config.Axes * PLANNER_FRAME_BYTES * 1000UL
+                 + config->BusBytesPerSecond - 1) / MAX(1, config->BusBytesPerSecond);
+    if (planner->Config.PeriodMs < minPeriod) {
+        DMM_PRINTF("Planner period %u ms over the bus budget, using %u ms\n",
+                   planner->Config.PeriodMs, minPeriod);
+        planner->Config.PeriodMs = minPeriod;
+    }
+    planner->Config.PeriodMs = MAX(1, planner->Config.PeriodMs);
+    planner->Head = planner->Count = 0;
+    planner->Window = PLANNER_LOOKAHEAD;
+    planner->Done = planner->Speed = 0;
+    for (i = 0; i < planner->Config.Axes; i++) {
+        planner->End[i] = start[i];
+        planner->LastSent[i] = start[i];
+    }
+    planner->LastUpdate = millis();
+}
+
+// Fewer segments ahead means less latency between a waypoint and its
+// motion but lower corner speeds when segments are short
+void PlannerSetWindow(Planner_t * planner, unsigned char segments) {
+    planner->Window = MAX(1, MIN(segments, PLANNER_LOOKAHEAD));
+}
+
+bool PlannerIdle(const Planner_t * planner) {
+    return planner->Count == 0;
+}
+
+static PathSegment_t * Segment(Planner_t * planner, unsigned char k) {
+    return &planner->Segments[(planner->Head + k) % PLANNER_LOOKAHEAD];
+}
+
+// Largest speed at a corner whose arc, tangent to both segments at the
+// path acceleration, stays within BlendTolerance of the waypoint
+static float CornerSpeed(const Planner_t * planner, const PathSegment_t * from, const PathSegment_t * to) {
+    float cosTheta = 0, sinHalf, accel;
+    unsigned char i;
+
+    for (i = 0; i < planner->Config.Axes; i++) {
+        cosTheta -= from->Unit[i] * to->Unit[i];
+    }
+    if (cosTheta > 0.999f) {
+        return 0; // reversal
+    }
+    if (cosTheta < -0.999f) {
+        return MIN(from->MaxSpeed, to->MaxSpeed); // straight on
+    }
+    sinHalf = sqrtf(0.5f * (1 - cosTheta));
+    accel = MIN(from->MaxAccel, to->MaxAccel);
+    return MIN(MIN(from->MaxSpeed, to->MaxSpeed),
+               sqrtf(accel * planner->Config.BlendTolerance * sinHalf / (1 - sinHalf)));
+}
+
+// Backward pass: every segment must be able to slow down to the next entry
+// and the last one to a stop. Forward pass: no entry faster than reachable
+// from the current speed. The head segment is running, only its exit moves.
+static void Replan(Planner_t * planner) {
+    PathSegment_t * seg;
+    float exit = 0, reach;
+    unsigned char k;
+
+    for (k = planner->Count - 1; k >= 1; k--) {
+        seg = Segment(planner, k);
+        seg->Entry = MIN(seg->MaxEntry, sqrtf(exit * exit + 2 * seg->MaxAccel * seg->Length));
+        exit = seg->Entry;
+    }
+    seg = Segment(planner, 0);
+    reach = sqrtf(planner->Speed * planner->Speed
+                  + 2 * seg->MaxAccel * MAX(0, seg->Length - planner->Done));
+    for (k = 1; k < planner->Count; k++) {
+        seg = Segment(planner, k);
+        seg->Entry = MIN(seg->Entry, reach);
+        reach = sqrtf(seg->Entry * seg->Entry + 2 * seg->MaxAccel * seg->Length);
+    }
+}
+
+// Queue the next corner of the polyline. Returns false when the lookahead
+// window is full; call PlannerUpdate() and try again.
+bool PlannerAddWaypoint(Planner_t * planner, const long * position) {
+    PathSegment_t * seg, * prev;
+    float delta[PLANNER_AXES], length = 0, u;
+    unsigned char i;
+
+    if (planner->Count >= planner->Window) {
+        return false;
+    }
+    for (i = 0; i < planner->Config.Axes; i++) {
+        delta[i] = position[i] - planner->End[i];
+        length += delta[i] * delta[i];
+    }
+    length = sqrtf(length);
+    if (length < PLANNER_MIN_LENGTH) {
+        return true;
+    }
+
+    seg = Segment(planner, planner->Count);
+    seg->Length = length;
+    seg->MaxSpeed = seg->MaxAccel = 1e30f;
+    for (i = 0; i < planner->Config.Axes; i++) {
+        seg->Start[i] = planner->End[i];
+        seg->Unit[i] = u = delta[i] / length;
+        if (fabsf(u) > 1e-6f) {
+            seg->MaxSpeed = MIN(seg->MaxSpeed, planner->Config.MaxSpeed[i] / fabsf(u));
+            seg->MaxAccel = MIN(seg->MaxAccel, planner->Config.MaxAccel[i] / fabsf(u));
+        }
+        planner->End[i] = position[i];
+    }
+    if (planner->Count == 0) {
+        seg->MaxEntry = planner->Speed = 0; // starting from rest
+        planner->Done = 0;
+    } else {
+        prev = Segment(planner, planner->Count - 1);
+        seg->MaxEntry = CornerSpeed(planner, prev, seg);
+    }
+    seg->Entry = seg->MaxEntry;
+    planner->Count++;
+    Replan(planner);
+    return true;
+}
+
+// Advance along the path by dt seconds, crossing into the following
+// segments as needed
+static void Advance(Planner_t * planner, float dt) {
+    PathSegment_t * seg;
+    float exit, v, step;
+
+    while (planner->Count && dt > 0) {
+        seg = Segment(planner, 0);
+        exit = (planner->Count > 1) ? Segment(planner, 1)->Entry : 0;
+        v = MIN(seg->MaxSpeed, planner->Speed + seg->MaxAccel * dt);
+        v = MIN(v, sqrtf(exit * exit + 2 * seg->MaxAccel * MAX(0, seg->Length - planner->Done)));
+        step = v * dt;
+        if (planner->Done + step < seg->Length) {
+            planner->Done += step;
+            planner->Speed = v;
+            return;
+        }
+        // Segment finished within this period, spend what is left on the next
+        dt -= (v > 0) ? (seg->Length - planner->Done) / v : dt;
+        planner->Head = (planner->Head + 1) % PLANNER_LOOKAHEAD;
+        planner->Count--;
+        planner->Done = 0;
+        planner->Speed = exit;
+    }
+}
+
+// Call from loop(). Steps the path by however many periods have passed and
+// sends the axes whose setpoint changed. Returns true while moving.
+bool PlannerUpdate(Planner_t * planner) {
+    const unsigned int period = planner->Config.PeriodMs;
+    unsigned long now = millis();
+    PathSegment_t * seg;
+    long pos;
+    unsigned char i;
+
+    if (now - planner->LastUpdate < period) {
+        return !PlannerIdle(planner);
+    }
+    if (now - planner->LastUpdate > 1000) { // not called for a while, don't replay it all
+        planner->LastUpdate = now - period;
+    }
+    while (now - planner->LastUpdate >= period) {
+        planner->LastUpdate += period;
+        Advance(planner, period / 1000.0f);
+    }
+
+    seg = Segment(planner, 0);
+    for (i = 0; i < planner->Config.Axes; i++) {
+        pos = planner->Count ? lroundf(seg->Start[i] + seg->Unit[i] * planner->Done)
+                             : lroundf(planner->End[i]);
+        if (pos != planner->LastSent[i]) {
+            MoveMotorToAbsolutePosition32(planner->Config.Axis[i], pos);
+            planner->LastSent[i] = pos;
+        }
+    }
+    return !PlannerIdle(planner);
+}
@@ -0,0 +1,70 @@
+/*
+
+Multi-axis path planner. Waypoints of a polyline go into a lookahead window;
+the planner joins consecutive segments at a corner speed set by the blend
+tolerance (junction deviation: the arc that would round the corner within
+BlendTolerance counts at the axes' acceleration), plans entry speeds over
+the whole window so the path only stops where it ends, and streams one
+Go_Absolute_Pos per axis every PeriodMs. All axes step along the same path
+position, so they stay synchronized.
+
+Speed and acceleration along a segment are the largest that keep every axis
+within its own limits. PeriodMs is raised if needed so a full set of
+setpoints fits the bus byte budget. Set_HighSpeed/Set_HighAccel on the
+drives should be high enough not to slow the stream down.
+
+*/
+
+#ifndef DmmDriver_DmmPlanner_h
+#define DmmDriver_DmmPlanner_h
+
+#include "DmmDriver.h"
+
+#ifndef PLANNER_AXES
+    #define PLANNER_AXES 3
+#endif
+
+#ifndef PLANNER_LOOKAHEAD
+    #define PLANNER_LOOKAHEAD 8 // segments planned ahead
+#endif
+
+#define BUS_BYTES_PER_SECOND 3840 // 38400 baud, 10 bits per byte
+
+typedef struct {
+    char Axis[PLANNER_AXES];          // drive IDs
+    unsigned char Axes;               // in use
+    float MaxSpeed[PLANNER_AXES];     // counts/s
+    float MaxAccel[PLANNER_AXES];     // counts/s^2
+    float BlendTolerance;             // counts a corner may be cut by
+    unsigned int PeriodMs;            // setpoint period
+    unsigned int BusBytesPerSecond;   // share of the link the planner may use
+} PlannerConfig_t;
+
+typedef struct {
+    float Start[PLANNER_AXES];
+    float Unit[PLANNER_AXES];         // direction, unit length
+    float Length;
+    float MaxSpeed, MaxAccel;         // along the path
+    float MaxEntry;                   // corner limit at the start
+    float Entry;                      // planned entry speed
+} PathSegment_t;
+
+typedef struct {
+    PlannerConfig_t Config;
+    PathSegment_t Segments[PLANNER_LOOKAHEAD];
+    unsigned char Head, Count;        // ring of queued segments, Head executing
+    unsigned char Window;             // segments used for lookahead, <= PLANNER_LOOKAHEAD
+    float End[PLANNER_AXES];          // last waypoint added
+    float Done, Speed;                // progress along the head segment
+    long LastSent[PLANNER_AXES];
+    unsigned long LastUpdate;
+} Planner_t;
+
+void DefaultPlannerConfig(PlannerConfig_t * config, unsigned char axes) ;
+void PlannerInit(Planner_t * planner, const PlannerConfig_t * config, const long * start) ;
+void PlannerSetWindow(Planner_t * planner, unsigned char segments) ;
+bool PlannerAddWaypoint(Planner_t * planner, const long * position) ;
+bool PlannerUpdate(Planner_t * planner) ;
+bool PlannerIdle(const Planner_t * planner) ;
+
+#endif // DmmDriver_DmmPlanner_h
@@ -0,0 +1,65 @@
+
+#include <math.h>
+#include "Arduino.h"
+#include "DmmRamp.h"
+
+// Start at rest; the first update sends speed 0
+void SpeedRampInit(SpeedRamp_t * ramp, char Axis_Num, float maxAccel, float maxJerk, unsigned int periodMs) {
+    ramp->Axis = Axis_Num;
+    ramp->Speed = ramp->Accel = ramp->Target = 0;
+    ramp->MaxAccel = maxAccel;
+    ramp->MaxJerk = maxJerk;
+    ramp->PeriodMs = MAX(1, periodMs);
+    ramp->LastUpdate = millis();
+    ramp->LastSent = LONG_MIN;
+}
+
+void SpeedRampSetTarget(SpeedRamp_t * ramp, long speed) {
+    ramp->Target = MAX(CONST_SPEED_MIN, MIN(CONST_SPEED_MAX, speed));
+}
+
+bool SpeedRampIdle(const SpeedRamp_t * ramp) {
+    return ramp->Speed == ramp->Target && ramp->Accel == 0;
+}
+
+// Call from loop(). Advances the profile by however many periods have
+// passed and sends the new speed if it changed. Returns true while ramping.
+bool SpeedRampUpdate(SpeedRamp_t * ramp) {
+    const float dt = ramp->PeriodMs / 1000.0f;
+    const float dj = ramp->MaxJerk * dt;
+    unsigned long now = millis();
+    float dv, settle;
+    long speed;
+
+    if (now - ramp->LastUpdate < ramp->PeriodMs) {
+        return !SpeedRampIdle(ramp);
+    }
+    if (now - ramp->LastUpdate > 1000) { // not called for a while, don't replay it all
+        ramp->LastUpdate = now - ramp->PeriodMs;
+    }
+    while (now - ramp->LastUpdate >= ramp->PeriodMs) {
+        ramp->LastUpdate += ramp->PeriodMs;
+        dv = ramp->Target - ramp->Speed;
+        if (fabsf(dv) <= fabsf(ramp->Accel) * dt && fabsf(ramp->Accel) <= dj) {
+            ramp->Speed = ramp->Target; // close enough to land this period
+            ramp->Accel = 0;
+            continue;
+        }
+        // Speed still gained while the acceleration is brought back to zero;
+        // once that covers what is left, start easing off
+        settle = ramp->Accel * fabsf(ramp->Accel) / (2 * ramp->MaxJerk);
+        if (dv - settle > 0) {
+            ramp->Accel = MIN(ramp->MaxAccel, ramp->Accel + dj);
+        } else {
+            ramp->Accel = MAX(-ramp->MaxAccel, ramp->Accel - dj);
+        }
+        ramp->Speed += ramp->Accel * dt;
+    }
+
+    speed = lroundf(ramp->Speed);
+    if (speed != ramp->LastSent) {
+        MoveMotorConstantRotation(ramp->Axis, speed);
+        ramp->LastSent = speed;
+    }
+    return !SpeedRampIdle(ramp);
+}
@@ -0,0 +1,37 @@
+/*
+
+Host side jerk-limited speed ramps for Turn_ConstSpeed. The drive's own
+acceleration is one coarse Set_HighAccel step, so reversing with a single
+MoveMotorConstantRotation is either abrupt or slow. A SpeedRamp_t instead
+streams Turn_ConstSpeed updates every PeriodMs along an S-curve: the
+acceleration itself ramps at MaxJerk up to MaxAccel and back to zero as
+the target speed is reached. Set Set_HighAccel high (e.g. 127) while a
+ramp is in use so the drive follows each update closely.
+
+Speeds are in Turn_ConstSpeed units and stay within the 3 byte payload
+(CONST_SPEED_MIN ~ CONST_SPEED_MAX). Only changed values go on the bus.
+
+*/
+
+#ifndef DmmDriver_DmmRamp_h
+#define DmmDriver_DmmRamp_h
+
+#include "DmmDriver.h"
+
+typedef struct {
+    char Axis;
+    float Speed, Accel;      // where the profile is now
+    float Target;
+    float MaxAccel;          // speed units per s
+    float MaxJerk;           // speed units per s^2
+    unsigned int PeriodMs;   // time between updates
+    unsigned long LastUpdate;
+    long LastSent;
+} SpeedRamp_t;
+
+void SpeedRampInit(SpeedRamp_t * ramp, char Axis_Num, float maxAccel, float maxJerk, unsigned int periodMs) ;
+void SpeedRampSetTarget(SpeedRamp_t * ramp, long speed) ;
+bool SpeedRampUpdate(SpeedRamp_t * ramp) ;
+bool SpeedRampIdle(const SpeedRamp_t * ramp) ;
+
+#endif // DmmDriver_DmmRamp_h
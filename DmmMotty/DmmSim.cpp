@@ -0,0 +1,286 @@
+
+#include <math.h>
+#include <string.h>
+#include "Arduino.h"
+#include "DmmSim.h"
+
+DmmSimDrive::DmmSimDrive() {
+    memset(Axes, 0, sizeof(Axes));
+    AxisCount = 0;
+    RxNum = RxLength = 0;
+    TxTop = TxBtm = 0;
+    LastMillis = 0;
+    CorruptEvery = FrameCount = 0;
+    ByteUs = DMM_BYTE_US;
+    HostLineFreeAt = DriveLineFreeAt = 0;
+}
+
+// Power up a drive with the given ID, at the origin with mid range gains
+SimAxis_t * DmmSimDrive::AddAxis(char ID) {
+    SimAxis_t * a;
+    if (AxisCount >= DMM_SIM_AXES) {
+        return 0;
+    }
+    a = &Axes[AxisCount++];
+    memset(a, 0, sizeof(*a));
+    a->ID = ID & 0x7f;
+    a->MainGain = a->SpeedGain = a->IntGain = 64;
+    a->HighSpeed = a->HighAccel = 1;
+    a->OnRange = 10;
+    a->GearNumber = 4096;
+    a->TrqCons = 100;
+    return a;
+}
+
+SimAxis_t * DmmSimDrive::Axis(char ID) {
+    unsigned char i;
+    for (i = 0; i < AxisCount; i++) {
+        if (Axes[i].ID == (ID & 0x7f)) {
+            return &Axes[i];
+        }
+    }
+    return 0;
+}
+
+// Corrupt one bit in every n-th frame each way, to exercise CRC handling
+void DmmSimDrive::SetCorruptEvery(unsigned int frames) {
+    CorruptEvery = frames;
+}
+
+void DmmSimDrive::SetBaudRate(long baud) {
+    ByteUs = baud ? 10000000UL / baud : 0;
+}
+
+void DmmSimDrive::Step(unsigned int ms) {
+    unsigned char i;
+    while (ms--) {
+        for (i = 0; i < AxisCount; i++) {
+            StepAxis(&Axes[i]);
+        }
+    }
+}
+
+// Run the model up to now; after a long pause only the last second is run
+void DmmSimDrive::CatchUp() {
+    unsigned long now = millis(), elapsed;
+    if (LastMillis == 0) {
+        LastMillis = now;
+    }
+    elapsed = now - LastMillis;
+    LastMillis = now;
+    Step(elapsed > 1000 ? 1000 : elapsed);
+}
+
+void DmmSimDrive::StepAxis(SimAxis_t * a) {
+    const float dt = 0.001f;
+    float vmax = a->HighSpeed * SIM_SPEED_UNIT;
+    float amax = a->HighAccel * SIM_ACCEL_UNIT;
+    float desired, d, dv, e, friction;
+
+    // Profile generator
+    if (a->SpeedMode) {
+        desired = a->ConstSpeed * SIM_CONST_SPEED_UNIT;
+        desired = MAX(-vmax, MIN(vmax, desired));
+    } else {
+        d = a->Target - a->Reference;
+        desired = sqrtf(2.0f * amax * fabsf(d));
+        desired = MIN(vmax, desired);
+        desired = (d < 0) ? -desired : desired;
+        if (fabsf(d) < 0.5f && fabsf(a->ReferenceVelocity) <= amax * dt) {
+            a->Reference = a->Target;
+            a->ReferenceVelocity = 0;
+            desired = 0;
+        }
+    }
+    dv = desired - a->ReferenceVelocity;
+    dv = MAX(-amax * dt, MIN(amax * dt, dv));
+    a->ReferenceVelocity += dv;
+    a->Reference += a->ReferenceVelocity * dt;
+
+    // Servo loop
+    if ((a->Config & Config_Bit_MOTOR_DRIVE) || a->Alarm == 1) {
+        a->Torque = 0; // free shaft
+        a->Integral = 0;
+    } else {
+        e = a->Reference - a->Position;
+        if (fabsf(e) > SIM_LOST_PHASE) {
+            a->Alarm = 1; // Lost Phase
+        }
+        a->Integral += e * dt;
+        a->Integral = MAX(-1000.0f, MIN(1000.0f, a->Integral));
+        a->Torque = 40.0f * a->MainGain * e + 100.0f * a->IntGain * a->Integral
+                  + 1.0f * a->SpeedGain * (a->ReferenceVelocity - a->Velocity);
+        a->Torque = MAX(-SIM_MAX_TORQUE, MIN(SIM_MAX_TORQUE, a->Torque));
+    }
+
+    // Unit inertia with Coulomb friction, which sticks below its breakaway torque
+    friction = 2000.0f;
+    if (fabsf(a->Velocity) < 1.0f && fabsf(a->Torque) <= friction) {
+        a->Velocity = 0;
+        return;
+    }
+    a->Velocity += (a->Torque - ((a->Velocity < 0) ? -friction : friction)) * dt;
+    a->Position += a->Velocity * dt;
+}
+
+long DmmSimDrive::ParameterValue(SimAxis_t * a, unsigned char isCode) {
+    long status;
+    switch (isCode) {
+        case Is_AbsPos32: return lroundf(a->Position);
+        case Is_TrqCurrent: return (long)(a->Torque * 32767.0f / SIM_MAX_TORQUE);
+        case Is_MainGain: return a->MainGain;
+        case Is_SpeedGain: return a->SpeedGain;
+        case Is_IntGain: return a->IntGain;
+        case Is_Config: return a->Config;
+        case Is_PosOn_Range: return a->OnRange;
+        case Is_GearNumber: return a->GearNumber;
+        case Is_TrqCons: return a->TrqCons;
+        case Is_HighSpeed: return a->HighSpeed;
+        case Is_HighAccel: return a->HighAccel;
+        case Is_Drive_ID: return a->ID;
+        case Is_Status:
+            status = 0;
+            if (!a->SpeedMode && fabsf(a->Target - a->Position) <= a->OnRange) status |= 1;
+            if ((a->Config & Config_Bit_MOTOR_DRIVE) || a->Alarm == 1) status |= 2;
+            status |= (a->Alarm & 7) << 2;
+            if (a->Reference != a->Target || a->ReferenceVelocity != 0) status |= 32;
+            if (a->Alarm == 4) a->Alarm = 0; // a CRC report is given once
+            return status;
+        default: return 0;
+    }
+}
+
+// Queue a reply on the return line, after the query that asked for it has
+// arrived and behind any reply still being sent
+void DmmSimDrive::Reply(SimAxis_t * a, unsigned char isCode) {
+    unsigned char B[8], Package_Length, i;
+    unsigned long at = HostLineFreeAt + SIM_TURNAROUND_US;
+    Package_Length = Encode_Package(isCode, a->ID, ParameterValue(a, isCode), B);
+    if (CorruptEvery && ++FrameCount % CorruptEvery == 0) {
+        B[Package_Length - 1] ^= 0x01;
+    }
+    if (ByteUs == 0) {
+        at = micros();
+    } else if ((long)(DriveLineFreeAt - at) > 0) {
+        at = DriveLineFreeAt;
+    }
+    for (i = 0; i < Package_Length; i++) {
+        if ((unsigned char)(TxTop + 1) % sizeof(TxBuffer) == TxBtm) {
+            return; // the host is not reading, replies are lost as on a UART
+        }
+        at += ByteUs;
+        TxBuffer[TxTop] = B[i];
+        TxReadyAt[TxTop] = at;
+        TxTop = (TxTop + 1) % sizeof(TxBuffer);
+    }
+    DriveLineFreeAt = at;
+}
+
+void DmmSimDrive::HandleFrame() {
+    unsigned char CRC_Check = 0, func, i;
+    SimAxis_t * a = Axis(RxFrame[0] & 0x7f);
+    long value;
+    if (a == 0) {
+        return; // no drive with this ID on the bus
+    }
+    for (i = 0; i < RxLength - 1; i++) {
+        CRC_Check += RxFrame[i];
+    }
+    if (CorruptEvery && ++FrameCount % CorruptEvery == 0) {
+        CRC_Check ^= 0x01;
+    }
+    if (((CRC_Check ^ RxFrame[RxLength - 1]) & 0x7f) != 0) {
+        a->Alarm = 4; // CRC Error Report, Command not Accepted
+        return;
+    }
+    func = RxFrame[1] & 0x1f;
+    value = Cal_SignValue(RxFrame);
+    switch (func) {
+        case Go_Absolute_Pos: a->Target = value; a->SpeedMode = false; break;
+        case Turn_ConstSpeed: a->ConstSpeed = value; a->SpeedMode = true; break;
+        case Set_Origin:
+            a->Position = a->Reference = 0;
+            a->Target = 0;
+            a->Integral = 0;
+            break;
+        case Set_HighSpeed: a->HighSpeed = MAX(1, MIN(127, value)); break;
+        case Set_HighAccel: a->HighAccel = MAX(1, MIN(127, value)); break;
+        case Set_MainGain: a->MainGain = MAX(1, MIN(127, value)); break;
+        case Set_SpeedGain: a->SpeedGain = MAX(1, MIN(127, value)); break;
+        case Set_IntGain: a->IntGain = MAX(1, MIN(127, value)); break;
+        case Set_Drive_Config: a->Config = value & 0x7f; break;
+        case Set_TrqCons: a->TrqCons = MAX(1, MIN(127, value)); break;
+        case Set_Pos_OnRange: a->OnRange = MAX(0, MIN(127, value)); break;
+        case Set_GearNumber: a->GearNumber = MAX(500, MIN(16384, value)); break;
+        case General_Read: Reply(a, value & 0x1f); break;
+        case Read_MainGain: Reply(a, Is_MainGain); break;
+        case Read_SpeedGain: Reply(a, Is_SpeedGain); break;
+        case Read_IntGain: Reply(a, Is_IntGain); break;
+        case Read_TrqCons: Reply(a, Is_TrqCons); break;
+        case Read_HighSpeed: Reply(a, Is_HighSpeed); break;
+        case Read_HighAccel: Reply(a, Is_HighAccel); break;
+        case Read_Drive_Config: Reply(a, Is_Config); break;
+        case Read_Drive_Status: Reply(a, Is_Status); break;
+        case Read_Pos_OnRange: Reply(a, Is_PosOn_Range); break;
+        case Read_GearNumber: Reply(a, Is_GearNumber); break;
+        case Read_Drive_ID: Reply(a, Is_Drive_ID); break;
+    }
+}
+
+// Whether the i-th byte queued for the host has arrived yet
+bool DmmSimDrive::Ready(unsigned char i) {
+    unsigned char n = (TxTop - TxBtm + sizeof(TxBuffer)) % sizeof(TxBuffer);
+    return i < n && (ByteUs == 0 || (long)(micros() - TxReadyAt[(TxBtm + i) % sizeof(TxBuffer)]) >= 0);
+}
+
+int DmmSimDrive::available() {
+    unsigned char n = 0;
+    CatchUp();
+    while (Ready(n)) {
+        n++;
+    }
+    return n;
+}
+
+int DmmSimDrive::read() {
+    unsigned char c;
+    if (!Ready(0)) {
+        return -1;
+    }
+    c = TxBuffer[TxBtm];
+    TxBtm = (TxBtm + 1) % sizeof(TxBuffer);
+    return c;
+}
+
+int DmmSimDrive::peek() {
+    return Ready(0) ? TxBuffer[TxBtm] : -1;
+}
+
+// Frames are assembled like ReadPackage does: a byte with the top bit clear
+// starts one, byte 1 gives its length
+size_t DmmSimDrive::write(uint8_t b) {
+    unsigned long now = micros();
+    CatchUp();
+    // The host's bytes go out one after another; a frame is handled when
+    // its last byte is in, and a reply times from HostLineFreeAt
+    if ((long)(HostLineFreeAt - now) < 0) {
+        HostLineFreeAt = now;
+    }
+    HostLineFreeAt += ByteUs;
+    if ((b & 0x80) == 0) {
+        RxNum = 0;
+        RxLength = 0;
+    } else if (RxNum == 0) {
+        return 1; // not in a frame
+    }
+    RxFrame[RxNum++] = b;
+    if (RxNum == 2) {
+        RxLength = 4 + ((b >> 5) & 0x03);
+    }
+    if (RxNum == RxLength) {
+        HandleFrame();
+        RxNum = 0;
+        RxLength = 0;
+    }
+    return 1;
+}
@@ -0,0 +1,91 @@
+/*
+
+Simulated DMM drive. DmmSimDrive is a Stream, so the driver talks to it
+exactly as it would to a UART once SetDmmPort(&sim) is called: commands are
+parsed and checked like the real drive does, queries are answered with
+properly framed replies, and each axis runs a servo model in 1 ms steps
+(profile generator limited by Set_HighSpeed/Set_HighAccel, PID from the
+main/speed/integration gains, inertia and Coulomb friction) that catches
+up with millis() whenever the stream is used.
+
+Bytes take as long as on the wire at DMM_BAUD_RATE: a query reaches the
+drive once its last byte is out, the reply starts SIM_TURNAROUND_US later
+and replies from several axes queue on the one return line, so code that
+pipelines requests sees the same delays as on hardware. SetBaudRate(0)
+makes the link instant.
+
+The model is not calibrated against a real motor; it reproduces the
+qualitative effects of the gains (sluggish, overshooting, unstable) well
+enough to develop tuning and benchmarking code without hardware.
+
+*/
+
+#ifndef DmmDriver_DmmSim_h
+#define DmmDriver_DmmSim_h
+
+#include "DmmDriver.h"
+
+#ifndef DMM_SIM_AXES
+    #define DMM_SIM_AXES 2
+#endif
+
+#define SIM_SPEED_UNIT 1000.0f       // counts/s per Set_HighSpeed step
+#define SIM_ACCEL_UNIT 10000.0f      // counts/s^2 per Set_HighAccel step
+#define SIM_CONST_SPEED_UNIT 100.0f  // counts/s per Turn_ConstSpeed step
+#define SIM_MAX_TORQUE 2000000.0f
+#define SIM_LOST_PHASE 8192          // |Pset - Pmotor| raising alarm 1
+
+#ifndef SIM_TURNAROUND_US
+    #define SIM_TURNAROUND_US 500        // end of a query until its reply starts
+#endif
+
+typedef struct {
+    char ID;
+    float Position, Velocity;            // counts, counts/s
+    float Reference, ReferenceVelocity;  // profile generator
+    float Integral, Torque;
+    long Target;                         // Go_Absolute_Pos
+    long ConstSpeed;                     // Turn_ConstSpeed
+    bool SpeedMode;
+    unsigned char MainGain, SpeedGain, IntGain;
+    unsigned char HighSpeed, HighAccel, OnRange, TrqCons, Config, Alarm;
+    unsigned int GearNumber;
+} SimAxis_t;
+
+class DmmSimDrive : public Stream {
+public:
+    DmmSimDrive();
+    SimAxis_t * AddAxis(char ID);
+    SimAxis_t * Axis(char ID);
+    void Step(unsigned int ms);
+    void SetCorruptEvery(unsigned int frames); // 0: a clean link
+    void SetBaudRate(long baud); // 0: bytes arrive at once
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t b);
+    void flush() {}
+    using Stream::write;
+
+private:
+    void CatchUp();
+    void StepAxis(SimAxis_t * a);
+    void HandleFrame();
+    void Reply(SimAxis_t * a, unsigned char isCode);
+    long ParameterValue(SimAxis_t * a, unsigned char isCode);
+
+    SimAxis_t Axes[DMM_SIM_AXES];
+    unsigned char AxisCount;
+    unsigned char RxFrame[8], RxNum, RxLength;
+    bool Ready(unsigned char i);
+
+    unsigned char TxBuffer[64];
+    unsigned long TxReadyAt[64];         // micros() each byte has arrived by
+    unsigned char TxTop, TxBtm;
+    unsigned long ByteUs, HostLineFreeAt, DriveLineFreeAt;
+    unsigned long LastMillis;
+    unsigned int CorruptEvery, FrameCount;
+};
+
+#endif // DmmDriver_DmmSim_h
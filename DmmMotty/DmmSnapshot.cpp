@@ -0,0 +1,270 @@
+#include <string.h>
+#include "Arduino.h"
+#include "DmmSnapshot.h"
+
+// Restored in this order, so the config byte (which may engage the motor)
+// goes out after everything else
+const ConfigRegister_t ConfigRegisters[CONFIG_REGISTERS] = {
+    { Read_MainGain,     Set_MainGain,     Is_MainGain },
+    { Read_SpeedGain,    Set_SpeedGain,    Is_SpeedGain },
+    { Read_IntGain,      Set_IntGain,      Is_IntGain },
+    { Read_TrqCons,      Set_TrqCons,      Is_TrqCons },
+    { Read_HighSpeed,    Set_HighSpeed,    Is_HighSpeed },
+    { Read_HighAccel,    Set_HighAccel,    Is_HighAccel },
+    { Read_Pos_OnRange,  Set_Pos_OnRange,  Is_PosOn_Range },
+    { Read_GearNumber,   Set_GearNumber,   Is_GearNumber },
+    { Read_Drive_Config, Set_Drive_Config, Is_Config },
+};
+
+typedef struct {
+    unsigned char Drive, Register;
+    unsigned char Tries;
+    unsigned long Deadline; // micros()
+    bool Busy;
+} ConfigRead_t;
+
+static ConfigRead_t Reads[CONFIG_WINDOW];
+static DriveConfig_t * Configs;
+static unsigned long LineFreeAt; // micros() when the reads sent so far are out
+
+static void OnReply(char ID, unsigned char code, long value) {
+    DriveConfig_t * config;
+    ConfigRead_t * read;
+    unsigned char i;
+
+    for (i = 0; i < CONFIG_WINDOW; i++) {
+        read = &Reads[i];
+        if (!read->Busy) {
+            continue;
+        }
+        config = &Configs[read->Drive];
+        if (config->Axis == ID && ConfigRegisters[read->Register].Code == code) {
+            config->Value[read->Register] = value;
+            config->Valid |= 1 << read->Register;
+            read->Busy = false;
+            return;
+        }
+    }
+}
+
+static void SendRead(ConfigRead_t * read) {
+    unsigned long now = micros();
+    Send_Package(ConfigRegisters[read->Register].Read, Configs[read->Drive].Axis, 0); // 0: Dummy Data
+    if ((long)(LineFreeAt - now) < 0) {
+        LineFreeAt = now;
+    }
+    LineFreeAt += CONFIG_FRAME_BYTES * DMM_BYTE_US;
+    read->Deadline = LineFreeAt + CONFIG_TIMEOUT_US;
+}
+
+// Read the registers in masks[axis] of every axis, CONFIG_WINDOW at a time.
+// Clears and then sets the Valid bits of what was read.
+static void ReadRegisters(DriveConfig_t * configs, unsigned char axes, const unsigned int * masks, unsigned int timeoutMs) {
+    ReadCallback_t saved = GetReadCallback();
+    unsigned long start = millis(), now;
+    unsigned int next = 0, total = (unsigned int)axes * CONFIG_REGISTERS;
+    ConfigRead_t * read;
+    unsigned char i;
+    bool busy;
+
+    Configs = configs;
+    for (i = 0; i < axes; i++) {
+        configs[i].Valid &= ~masks[i];
+    }
+    for (i = 0; i < CONFIG_WINDOW; i++) {
+        Reads[i].Busy = false;
+    }
+    LineFreeAt = micros();
+    SetReadCallback(OnReply);
+
+    while (millis() - start < timeoutMs) {
+        DmmSerialEvent();
+        now = micros();
+        busy = false;
+        for (i = 0; i < CONFIG_WINDOW; i++) {
+            read = &Reads[i];
+            if (read->Busy && (long)(now - read->Deadline) >= 0) {
+                if (read->Tries < CONFIG_TRIES) {
+                    read->Tries++;
+                    SendRead(read);
+                } else {
+                    read->Busy = false; // its Valid bit stays clear
+                }
+            }
+            while (next < total && !(masks[next / CONFIG_REGISTERS] & (1 << (next % CONFIG_REGISTERS)))) {
+                next++;
+            }
+            if (!read->Busy && next < total) {
+                read->Drive = next / CONFIG_REGISTERS;
+                read->Register = next % CONFIG_REGISTERS;
+                read->Tries = 1;
+                read->Busy = true;
+                SendRead(read);
+                next++;
+            }
+            busy |= read->Busy;
+        }
+        if (!busy && next == total) {
+            break;
+        }
+    }
+    SetReadCallback(saved);
+}
+
+// Snapshot every register of configs[0..axes-1], whose Axis fields name the
+// drives. Returns how many axes were read completely.
+unsigned char ReadDriveConfigs(DriveConfig_t * configs, unsigned char axes, unsigned int timeoutMs) {
+    unsigned int masks[CONFIG_BATCH_AXES];
+    unsigned char base, n, i, complete = 0;
+
+    for (base = 0; base < axes; base += n) {
+        n = MIN(axes - base, CONFIG_BATCH_AXES);
+        for (i = 0; i < n; i++) {
+            masks[i] = CONFIG_ALL;
+        }
+        ReadRegisters(configs + base, n, masks, timeoutMs);
+    }
+    for (i = 0; i < axes; i++) {
+        complete += (configs[i].Valid == CONFIG_ALL);
+    }
+    return complete;
+}
+
+// Registers of the snapshot that the drive doesn't hold (or didn't answer for)
+static unsigned int Differences(const DriveConfig_t * saved, const DriveConfig_t * current) {
+    unsigned int mask = 0;
+    unsigned char r;
+    for (r = 0; r < CONFIG_REGISTERS; r++) {
+        if ((saved->Valid & (1 << r))
+            && (!(current->Valid & (1 << r)) || current->Value[r] != saved->Value[r])) {
+            mask |= 1 << r;
+        }
+    }
+    return mask;
+}
+
+static unsigned int RestoreBatch(const DriveConfig_t * saved, unsigned char axes, unsigned int timeoutMs) {
+    static DriveConfig_t current[CONFIG_BATCH_AXES];
+    unsigned int masks[CONFIG_BATCH_AXES], written = 0, pending;
+    unsigned char i, r, round;
+
+    for (i = 0; i < axes; i++) {
+        current[i].Axis = saved[i].Axis;
+        current[i].Valid = 0;
+        masks[i] = saved[i].Valid;
+    }
+    ReadRegisters(current, axes, masks, timeoutMs);
+
+    for (round = 0; round <= CONFIG_TRIES; round++) {
+        pending = 0;
+        for (i = 0; i < axes; i++) {
+            masks[i] = Differences(&saved[i], &current[i]);
+            for (r = 0; r < CONFIG_REGISTERS; r++) {
+                if (!(masks[i] & (1 << r))) {
+                    continue;
+                }
+                if (round == CONFIG_TRIES) {
+                    DMM_PRINTF("Drive %d: " DMM_STR_FMT " not restored\n", saved[i].Axis, ParameterName(ConfigRegisters[r].Code));
+                    continue;
+                }
+                Send_Package(ConfigRegisters[r].Set, saved[i].Axis, saved[i].Value[r]);
+                written++;
+                pending++;
+            }
+        }
+        if (pending == 0) {
+            break;
+        }
+        ReadRegisters(current, axes, masks, timeoutMs);
+    }
+    return written;
+}
+
+// Bring the drives back to a snapshot, sending only what differs and
+// reading it back, up to CONFIG_TRIES times for writes that didn't take.
+// Returns the number of Set_ commands sent.
+unsigned int RestoreDriveConfigs(const DriveConfig_t * saved, unsigned char axes, unsigned int timeoutMs) {
+    unsigned int written = 0;
+    unsigned char base, n;
+    for (base = 0; base < axes; base += n) {
+        n = MIN(axes - base, CONFIG_BATCH_AXES);
+        written += RestoreBatch(saved + base, n, timeoutMs);
+    }
+    return written;
+}
+
+static unsigned int PutVarint(unsigned char * out, long value) {
+    unsigned long v = ((unsigned long)value << 1) ^ (unsigned long)(value >> (sizeof(long) * 8 - 1)); // zigzag
+    unsigned int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+static bool GetVarint(const unsigned char * in, unsigned int length, unsigned int * at, long * value) {
+    unsigned long v = 0;
+    unsigned int shift = 0;
+    unsigned char b;
+    do {
+        if (*at >= length || shift >= sizeof(long) * 8) {
+            return false;
+        }
+        b = in[(*at)++];
+        v |= (unsigned long)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *value = (long)(v >> 1) ^ -(long)(v & 1);
+    return true;
+}
+
+// Header (magic, version, register count, axis count), then per axis its
+// ID, the Valid mask and each valid register as a zigzag varint. out must
+// hold SNAPSHOT_BUFFER_SIZE(axes). Returns the bytes used.
+unsigned int EncodeDriveConfigs(const DriveConfig_t * configs, unsigned char axes, unsigned char * out) {
+    unsigned int n = 7;
+    unsigned char i, r;
+
+    memcpy(out, SNAPSHOT_MAGIC, 4);
+    out[4] = SNAPSHOT_VERSION;
+    out[5] = CONFIG_REGISTERS;
+    out[6] = axes;
+    for (i = 0; i < axes; i++) {
+        out[n++] = configs[i].Axis;
+        out[n++] = configs[i].Valid & 0xFF;
+        out[n++] = configs[i].Valid >> 8;
+        for (r = 0; r < CONFIG_REGISTERS; r++) {
+            if (configs[i].Valid & (1 << r)) {
+                n += PutVarint(out + n, configs[i].Value[r]);
+            }
+        }
+    }
+    return n;
+}
+
+// Returns the axes decoded, 0 when the buffer is not a snapshot
+unsigned char DecodeDriveConfigs(const unsigned char * in, unsigned int length, DriveConfig_t * configs, unsigned char maxAxes) {
+    unsigned int at = 7;
+    unsigned char axes, i, r;
+
+    if (length < 7 || memcmp(in, SNAPSHOT_MAGIC, 4) != 0 || in[4] != SNAPSHOT_VERSION || in[5] != CONFIG_REGISTERS) {
+        return 0;
+    }
+    axes = MIN(in[6], maxAxes);
+    for (i = 0; i < axes; i++) {
+        if (at + 3 > length) {
+            return i;
+        }
+        configs[i].Axis = in[at++];
+        configs[i].Valid = in[at] | (in[at + 1] << 8);
+        at += 2;
+        for (r = 0; r < CONFIG_REGISTERS; r++) {
+            if ((configs[i].Valid & (1 << r)) && !GetVarint(in, length, &at, &configs[i].Value[r])) {
+                return i;
+            }
+        }
+    }
+    return axes;
+}
@@ -0,0 +1,65 @@
+/*
+
+Drive configuration snapshots. ReadDriveConfigs() reads every readable
+register of a set of axes (gains, torque constant, speed and acceleration
+limits, on-range window, gear number, config byte) in one pipelined pass.
+EncodeDriveConfigs() packs the result into a few bytes per axis, to keep in
+a file on the host or in EEPROM. RestoreDriveConfigs() reads the current
+values back and only sends the Set_ commands for registers that differ,
+then reads those again to check they took.
+
+Set_HighSpeed and Set_HighAccel are lost on power reset, so after a reset
+those two are what a restore usually ends up sending.
+
+Any number of axes can be passed; they are read and restored
+CONFIG_BATCH_AXES at a time, each batch given timeoutMs. As in discovery,
+a read's CONFIG_TIMEOUT_US runs from when its frame is expected to be out
+on the wire.
+
+*/
+
+#ifndef DmmDriver_DmmSnapshot_h
+#define DmmDriver_DmmSnapshot_h
+
+#include "DmmDriver.h"
+
+#define CONFIG_REGISTERS 9
+#define CONFIG_ALL ((1 << CONFIG_REGISTERS) - 1)
+
+#ifndef CONFIG_WINDOW
+    #define CONFIG_WINDOW 4          // reads in flight
+#endif
+
+#ifndef CONFIG_BATCH_AXES
+    #define CONFIG_BATCH_AXES 4      // axes read or restored together
+#endif
+
+#define CONFIG_FRAME_BYTES 4         // a read: no data beyond one dummy byte
+#define CONFIG_REPLY_BYTES 6         // longest reply, a gear number
+// From the end of a read: turnaround, then a reply that may queue behind
+// the replies to the other reads in flight
+#define CONFIG_TIMEOUT_US (DMM_TURNAROUND_US + CONFIG_WINDOW * CONFIG_REPLY_BYTES * DMM_BYTE_US)
+#define CONFIG_TRIES 3
+
+#define SNAPSHOT_MAGIC "DMMS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BUFFER_SIZE(axes) (7 + (axes) * (3 + CONFIG_REGISTERS * 5))
+
+typedef struct {
+    unsigned char Read, Set, Code; // function to read it, to write it, and the reply's Is_ code
+} ConfigRegister_t;
+
+typedef struct {
+    char Axis;
+    unsigned int Valid;            // a bit per register read
+    long Value[CONFIG_REGISTERS];
+} DriveConfig_t;
+
+extern const ConfigRegister_t ConfigRegisters[CONFIG_REGISTERS];
+
+unsigned char ReadDriveConfigs(DriveConfig_t * configs, unsigned char axes, unsigned int timeoutMs) ;
+unsigned int RestoreDriveConfigs(const DriveConfig_t * saved, unsigned char axes, unsigned int timeoutMs) ;
+unsigned int EncodeDriveConfigs(const DriveConfig_t * configs, unsigned char axes, unsigned char * out) ;
+unsigned char DecodeDriveConfigs(const unsigned char * in, unsigned int length, DriveConfig_t * configs, unsigned char maxAxes) ;
+
+#endif // DmmDriver_DmmSnapshot_h
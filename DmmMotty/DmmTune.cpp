@@ -0,0 +1,197 @@
+
+#include <limits.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "DmmTune.h"
+
+#define TUNE_QUERY_TIMEOUT 20 // ms to wait for one reply
+#define TUNE_TORQUE_EVERY 4   // sample torque once per this many positions
+
+void DefaultTuneConfig(TuneConfig_t * config) {
+    config->Start.MainGain = 64;
+    config->Start.SpeedGain = 64;
+    config->Start.IntGain = 32;
+    config->StepSize = 2000;
+    config->Tolerance = 10;
+    config->TrialMs = 1500;
+    config->HighSpeed = 20;
+    config->HighAccel = 20;
+    config->MaxTrials = 40;
+}
+
+static unsigned char * GainRef(Gains_t * g, unsigned char which) {
+    switch (which) {
+        case 0: return &g->MainGain;
+        case 1: return &g->SpeedGain;
+        default: return &g->IntGain;
+    }
+}
+
+static bool SameGains(const Gains_t * a, const Gains_t * b) {
+    return a->MainGain == b->MainGain && a->SpeedGain == b->SpeedGain && a->IntGain == b->IntGain;
+}
+
+static void SendGains(char Axis_Num, const Gains_t * g) {
+    SetMainGain(Axis_Num, g->MainGain);
+    SetSpeedGain(Axis_Num, g->SpeedGain);
+    SetIntGain(Axis_Num, g->IntGain);
+}
+
+// The gains the drive has now, so a failed tune can put them back
+static bool ReadGains(char Axis_Num, Gains_t * g) {
+    long main = QueryDrive(Read_MainGain, Axis_Num, 0, TUNE_QUERY_TIMEOUT);
+    long speed = QueryDrive(Read_SpeedGain, Axis_Num, 0, TUNE_QUERY_TIMEOUT);
+    long integral = QueryDrive(Read_IntGain, Axis_Num, 0, TUNE_QUERY_TIMEOUT);
+    if (main == LONG_MIN || speed == LONG_MIN || integral == LONG_MIN) {
+        return false;
+    }
+    g->MainGain = main;
+    g->SpeedGain = speed;
+    g->IntGain = integral;
+    return true;
+}
+
+// Move to 'to' with the given gains and score the response
+bool RunGainTrial(char Axis_Num, const Gains_t * gains, long to, const TuneConfig_t * config, TrialResult_t * result) {
+    unsigned long start, now, lastOutside = 0, errorSum = 0;
+    unsigned int samples = 0;
+    long from, pos, torque, past, status;
+    int dir;
+
+    result->SettleMs = config->TrialMs;
+    result->Overshoot = result->FollowingError = result->PeakTorque = 0;
+    result->Score = LONG_MAX;
+    result->Fault = true;
+
+    from = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, TUNE_QUERY_TIMEOUT);
+    if (from == LONG_MIN) {
+        return false;
+    }
+    dir = (to >= from) ? 1 : -1;
+
+    SendGains(Axis_Num, gains);
+    MoveMotorToAbsolutePosition32(Axis_Num, to);
+    start = millis();
+    while ((now = millis()) - start < config->TrialMs) {
+        pos = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, TUNE_QUERY_TIMEOUT);
+        if (pos == LONG_MIN) {
+            continue;
+        }
+        samples++;
+        if (labs(to - pos) > config->Tolerance) {
+            lastOutside = now - start;
+        }
+        past = (pos - to) * dir;
+        result->Overshoot = MAX(result->Overshoot, past);
+        errorSum += labs(to - pos);
+        if (samples % TUNE_TORQUE_EVERY == 0) {
+            torque = QueryDrive(General_Read, Axis_Num, Is_TrqCurrent, TUNE_QUERY_TIMEOUT);
+            if (torque != LONG_MIN) {
+                result->PeakTorque = MAX(result->PeakTorque, labs(torque));
+            }
+        }
+    }
+    if (samples == 0) {
+        return false;
+    }
+
+    status = QueryDrive(Read_Drive_Status, Axis_Num, 0, TUNE_QUERY_TIMEOUT);
+    if (status == LONG_MIN || (((status & 28) >> 2) >= 1 && ((status & 28) >> 2) <= 3)) {
+        return false; // Lost Phase, Over Current, Over Heat: stop tuning
+    }
+    result->Fault = false;
+
+    if (lastOutside < config->TrialMs - config->TrialMs / 10) {
+        result->SettleMs = lastOutside;
+    }
+    result->FollowingError = errorSum / samples;
+
+    // Settling time in ms, overshoot and mean error in permille of the step;
+    // a move that never settles costs the whole trial again
+    result->Score = result->SettleMs
+                  + 2 * (result->Overshoot * 1000 / config->StepSize)
+                  + result->FollowingError * 1000 / config->StepSize;
+    if (result->SettleMs == config->TrialMs) {
+        result->Score += config->TrialMs;
+    }
+    DMM_PRINTF("Gains %d/%d/%d: settle %u ms, overshoot %ld, error %ld, torque %ld, score %ld\n",
+               gains->MainGain, gains->SpeedGain, gains->IntGain, result->SettleMs,
+               result->Overshoot, result->FollowingError, result->PeakTorque, result->Score);
+    return true;
+}
+
+// Pattern search: try each gain one step up and down from the best set so
+// far, move to any improvement, and halve the step when none is found.
+// Trials alternate between two positions so no move is spent returning.
+bool AutoTune(char Axis_Num, const TuneConfig_t * config, Gains_t * best) {
+    Gains_t cacheGains[TUNE_CACHE_SIZE], cand, original;
+    long cacheScore[TUNE_CACHE_SIZE], bestScore, score;
+    unsigned char cached = 0, trials = 0, which, c, step = 32;
+    signed char sign;
+    long home, away;
+    bool improved, found;
+    TrialResult_t result;
+
+    home = QueryDrive(General_Read, Axis_Num, Is_AbsPos32, TUNE_QUERY_TIMEOUT);
+    if (home == LONG_MIN || !ReadGains(Axis_Num, &original)) {
+        return false;
+    }
+    away = home + config->StepSize;
+    SetMaxSpeed(Axis_Num, config->HighSpeed);
+    SetMaxAccel(Axis_Num, config->HighAccel);
+
+    *best = config->Start;
+    if (!RunGainTrial(Axis_Num, best, away, config, &result)) {
+        SendGains(Axis_Num, &original);
+        return false;
+    }
+    trials++;
+    bestScore = result.Score;
+    cacheGains[cached] = *best;
+    cacheScore[cached++] = bestScore;
+
+    while (step >= 1 && trials < config->MaxTrials) {
+        improved = false;
+        for (which = 0; which < 3 && !improved && trials < config->MaxTrials; which++) {
+            for (sign = 1; sign >= -1 && !improved && trials < config->MaxTrials; sign -= 2) {
+                cand = *best;
+                *GainRef(&cand, which) = MAX(1, MIN(127, *GainRef(&cand, which) + sign * step));
+                if (SameGains(&cand, best)) {
+                    continue;
+                }
+                found = false;
+                for (c = 0; c < cached; c++) {
+                    if (SameGains(&cacheGains[c], &cand)) {
+                        found = true;
+                        score = cacheScore[c];
+                    }
+                }
+                if (!found) {
+                    if (!RunGainTrial(Axis_Num, &cand, (trials % 2) ? home : away, config, &result)) {
+                        DMM_PRINTF("Autotune stopped on a fault\n");
+                        SendGains(Axis_Num, &original);
+                        return false;
+                    }
+                    trials++;
+                    score = result.Score;
+                    c = (cached < TUNE_CACHE_SIZE) ? cached++ : trials % TUNE_CACHE_SIZE;
+                    cacheGains[c] = cand;
+                    cacheScore[c] = score;
+                }
+                if (score < bestScore) {
+                    *best = cand;
+                    bestScore = score;
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) {
+            step /= 2;
+        }
+    }
+
+    SendGains(Axis_Num, best);
+    DMM_PRINTF("Autotune: %d trials, gains %d/%d/%d, score %ld\n",
+               trials, best->MainGain, best->SpeedGain, best->IntGain, bestScore);
+    return true;
+}
@@ -0,0 +1,49 @@
+/*
+
+Gain autotuning. Instead of trial and error with the Set_*Gain calls in
+setup(), AutoTune() runs step moves of a fixed size back and forth, each
+with a candidate set of main/speed/integration gains, samples Is_AbsPos32
+(and Is_TrqCurrent every few samples) as fast as the link allows, and
+scores settling time, overshoot and following error. A pattern search over
+the three 1-127 gains, with a small cache of already scored sets, keeps the
+number of trial moves low. Works the same against a DmmSimDrive. If the
+tune stops on a fault, the gains the drive had before it are set again.
+
+*/
+
+#ifndef DmmDriver_DmmTune_h
+#define DmmDriver_DmmTune_h
+
+#include "DmmDriver.h"
+
+#ifndef TUNE_CACHE_SIZE
+    #define TUNE_CACHE_SIZE 16 // scored gain sets remembered during a search
+#endif
+
+typedef struct {
+    unsigned char MainGain, SpeedGain, IntGain;
+} Gains_t;
+
+typedef struct {
+    Gains_t Start;          // where the search begins
+    long StepSize;          // counts per trial move
+    long Tolerance;         // settled when within this of the target
+    unsigned int TrialMs;   // length of each trial, long enough for the move to finish
+    unsigned char HighSpeed, HighAccel; // profile limits used for the trial moves
+    unsigned char MaxTrials;
+} TuneConfig_t;
+
+typedef struct {
+    unsigned int SettleMs;  // TrialMs when it never settled
+    long Overshoot;         // counts past the target
+    long FollowingError;    // mean |target - position| over the trial
+    long PeakTorque;        // largest |Is_TrqCurrent| seen
+    long Score;             // lower is better, LONG_MAX on a fault
+    bool Fault;             // fatal alarm or no replies
+} TrialResult_t;
+
+void DefaultTuneConfig(TuneConfig_t * config) ;
+bool RunGainTrial(char Axis_Num, const Gains_t * gains, long to, const TuneConfig_t * config, TrialResult_t * result) ;
+bool AutoTune(char Axis_Num, const TuneConfig_t * config, Gains_t * best) ;
+
+#endif // DmmDriver_DmmTune_h
@@ -0,0 +1,44 @@
+//
+//  Arduino.h
+//  SerialPortSample
+//
+//  Host stand-in for the Arduino core, so the driver sources in DmmMotty/
+//  build on the desktop against SerialPortSample.c (OS X) or
+//  SerialPortPosix.c (Linux). Put this directory first on the include path.
+//
+
+#ifndef DmmDriver_Arduino_h
+#define DmmDriver_Arduino_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+extern "C" {
+#include "SerialPort.h"
+}
+
+// The part of the core's Stream the driver uses
+class Stream {
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t b) = 0;
+    virtual void flush() {}
+};
+
+class HostSerial : public Stream {
+public:
+    void begin(long) {} // the port is opened with openSerial()
+    int available() { return (int)SerialAvailable(); }
+    int read() { return SerialRead(); }
+    int peek() { return -1; }
+    size_t write(uint8_t b) { SerialWrite((char)b); return 1; }
+};
+
+static HostSerial Serial;
+
+#endif // DmmDriver_Arduino_h
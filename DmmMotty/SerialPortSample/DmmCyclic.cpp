@@ -0,0 +1,211 @@
+//
+//  DmmCyclic.cpp
+//  SerialPortSample
+//
+
+#include <string.h>
+#include "Arduino.h"
+#include "DmmCyclic.h"
+
+void DefaultCyclicConfig(CyclicConfig_t * config) {
+    config->PeriodUs = 5000;
+    config->Priority = 80;
+    config->Cpu = -1;
+    config->LockMemory = true;
+}
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static CyclicConfig_t Config;
+static CyclicTask_t Task;
+static void * Context;
+static CyclicStats_t Stats;
+static pthread_t Thread;
+static uint32_t Running;
+
+static int64_t NowNs() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void SleepUntil(int64_t ns) {
+    struct timespec t;
+    t.tv_sec = ns / 1000000000;
+    t.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) ;
+}
+
+static unsigned char Bin(uint32_t us) {
+    unsigned char bin = (us < 2) ? 0 : 31 - __builtin_clz(us);
+    return MIN(bin, CYCLIC_BINS - 1);
+}
+
+// Same seqlock as the daemon's axis table
+static void BeginWrite() {
+    __atomic_store_n(&Stats.Seq, Stats.Seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void EndWrite() {
+    __atomic_store_n(&Stats.Seq, Stats.Seq + 1, __ATOMIC_RELEASE);
+}
+
+// Only what the thread can set for itself; mlockall() is done by CyclicStart()
+static uint32_t EnterRealTime() {
+    struct sched_param param;
+    cpu_set_t cpus;
+    uint32_t realTime = 0;
+
+    if (Config.Priority > 0) {
+        param.sched_priority = Config.Priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+            realTime |= CYCLIC_FIFO;
+        }
+    }
+    if (Config.Cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(Config.Cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+            realTime |= CYCLIC_PINNED;
+        }
+    }
+    return realTime;
+}
+
+// Fault the stack in now, so the locked pages are there before the first cycle
+static void PrefaultStack() {
+    volatile unsigned char stack[CYCLIC_PREFAULT_STACK];
+    unsigned int i;
+    for (i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+static void * CyclicLoop(void *) {
+    int64_t period = (int64_t)Config.PeriodUs * 1000;
+    int64_t next, now, late;
+    uint32_t latency, overrun, missed;
+
+    BeginWrite();
+    Stats.RealTime |= EnterRealTime();
+    EndWrite();
+    if (Stats.RealTime & CYCLIC_LOCKED) {
+        PrefaultStack();
+    }
+
+    next = NowNs();
+    while (__atomic_load_n(&Running, __ATOMIC_ACQUIRE)) {
+        next += period;
+        SleepUntil(next);
+        now = NowNs();
+        latency = (uint32_t)(MAX(now - next, 0) / 1000);
+
+        DmmSerialEvent();
+        Task(Context);
+
+        late = NowNs() - (next + period);
+        BeginWrite();
+        Stats.Cycles++;
+        Stats.Latency[Bin(latency)]++;
+        Stats.MaxLatencyUs = MAX(Stats.MaxLatencyUs, latency);
+        if (late >= 0) {
+            overrun = (uint32_t)(late / 1000);
+            missed = (uint32_t)(late / period) + 1;
+            next += (int64_t)missed * period;
+            Stats.Overruns++;
+            Stats.Missed += missed;
+            Stats.Overrun[Bin(overrun)]++;
+            Stats.MaxOverrunUs = MAX(Stats.MaxOverrunUs, overrun);
+        }
+        EndWrite();
+    }
+    return NULL;
+}
+
+// Start calling task(context) every config->PeriodUs. Returns false if the
+// thread couldn't be started, or is already running; real-time settings
+// that couldn't be applied don't fail the start, see CyclicStats_t.RealTime.
+bool CyclicStart(const CyclicConfig_t * config, CyclicTask_t task, void * context) {
+    if (__atomic_load_n(&Running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    Config = *config;
+    Task = task;
+    Context = context;
+    memset(&Stats, 0, sizeof(Stats));
+    if (Config.LockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        Stats.RealTime |= CYCLIC_LOCKED;
+    }
+    Running = 1;
+    if (pthread_create(&Thread, NULL, CyclicLoop, NULL) != 0) {
+        Running = 0;
+        if (Stats.RealTime & CYCLIC_LOCKED) {
+            munlockall();
+            Stats.RealTime &= ~CYCLIC_LOCKED;
+        }
+        return false;
+    }
+    return true;
+}
+
+void CyclicStop() {
+    if (!__atomic_exchange_n(&Running, 0, __ATOMIC_ACQ_REL)) {
+        return; // never started, or already stopped
+    }
+    pthread_join(Thread, NULL);
+    if (Stats.RealTime & CYCLIC_LOCKED) {
+        munlockall();
+    }
+}
+
+// Consistent copy of the statistics, from any thread
+void CyclicReadStats(CyclicStats_t * stats) {
+    uint32_t before, after;
+    do {
+        before = __atomic_load_n(&Stats.Seq, __ATOMIC_ACQUIRE);
+        memcpy(stats, &Stats, sizeof(*stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&Stats.Seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+#else // no clock_nanosleep or affinity: not supported
+
+bool CyclicStart(const CyclicConfig_t *, CyclicTask_t, void *) {
+    return false;
+}
+
+void CyclicStop() {
+}
+
+void CyclicReadStats(CyclicStats_t * stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif // __linux__
+
+void CyclicPrintStats(FILE * out) {
+    CyclicStats_t stats;
+    unsigned char i;
+
+    CyclicReadStats(&stats);
+    fprintf(out, "Cycles: %u, overruns: %u, missed: %u, max latency: %u us, max overrun: %u us%s%s%s\n",
+            stats.Cycles, stats.Overruns, stats.Missed, stats.MaxLatencyUs, stats.MaxOverrunUs,
+            (stats.RealTime & CYCLIC_FIFO) ? ", FIFO" : "",
+            (stats.RealTime & CYCLIC_PINNED) ? ", pinned" : "",
+            (stats.RealTime & CYCLIC_LOCKED) ? ", locked" : "");
+    fprintf(out, "%10s %10s %10s\n", "us", "latency", "overrun");
+    for (i = 0; i < CYCLIC_BINS; i++) {
+        if (stats.Latency[i] || stats.Overrun[i]) {
+            fprintf(out, "%9lu%c %10u %10u\n", (i == 0) ? 0UL : 1UL << i,
+                    (i == CYCLIC_BINS - 1) ? '+' : ' ', stats.Latency[i], stats.Overrun[i]);
+        }
+    }
+}
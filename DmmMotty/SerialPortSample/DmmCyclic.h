@@ -0,0 +1,67 @@
+//
+//  DmmCyclic.h
+//  SerialPortSample
+//
+//  Real-time cyclic executor for Linux hosts. delay() is a usleep(), good
+//  to a millisecond or so; streaming setpoints wants better. CyclicStart()
+//  runs a thread that wakes on absolute deadlines (clock_nanosleep with
+//  TIMER_ABSTIME, so lateness never accumulates), parses replies with
+//  DmmSerialEvent() and then calls a task to send the cycle's frames.
+//  Optionally the thread runs SCHED_FIFO, pinned to one CPU, with the
+//  process' memory locked so page faults can't stall it; each of these
+//  needs privileges (CAP_SYS_NICE, CAP_IPC_LOCK or a raised RLIMIT_MEMLOCK)
+//  and is reported in CyclicStats_t.RealTime when it took effect.
+//
+//  While the executor runs its thread owns the driver, as DmmIoThread's
+//  does; don't run both.
+//
+//  Per cycle the executor measures the wake-up latency (how late after
+//  the deadline the thread ran) and, when the cycle's work ran past the
+//  next deadline, the overrun. Both go into histograms with power of two
+//  bins: bin 0 counts 0..1 us, bin n counts 2^n..2^(n+1)-1 us, the last
+//  bin everything longer. A cycle that overruns doesn't make up for the
+//  deadlines it missed; the next wake-up is the next one still ahead.
+//
+
+#ifndef DmmDriver_DmmCyclic_h
+#define DmmDriver_DmmCyclic_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "DmmDriver.h"
+
+#define CYCLIC_BINS 20             // the last counts 2^19 us = 0.5 s and longer
+#define CYCLIC_PREFAULT_STACK 65536 // bytes of stack touched before the first cycle
+
+// CyclicStats_t.RealTime bits
+#define CYCLIC_FIFO 1
+#define CYCLIC_PINNED 2
+#define CYCLIC_LOCKED 4
+
+typedef void (*CyclicTask_t)(void * context);
+
+typedef struct {
+    unsigned long PeriodUs;
+    int Priority;                  // SCHED_FIFO 1..99, 0 to keep the normal policy
+    int Cpu;                       // to pin the thread to, -1 for any
+    bool LockMemory;               // mlockall() the process
+} CyclicConfig_t;
+
+typedef struct {
+    uint32_t Seq;                  // odd while the executor is writing
+    uint32_t RealTime;             // CYCLIC_ bits that took effect
+    uint32_t Cycles;
+    uint32_t Overruns;             // cycles whose work ran past the next deadline
+    uint32_t Missed;               // deadlines skipped after overruns
+    uint32_t MaxLatencyUs, MaxOverrunUs;
+    uint32_t Latency[CYCLIC_BINS];
+    uint32_t Overrun[CYCLIC_BINS];
+} CyclicStats_t;
+
+void DefaultCyclicConfig(CyclicConfig_t * config) ;
+bool CyclicStart(const CyclicConfig_t * config, CyclicTask_t task, void * context) ;
+void CyclicStop() ;
+void CyclicReadStats(CyclicStats_t * stats) ;
+void CyclicPrintStats(FILE * out) ;
+
+#endif // DmmDriver_DmmCyclic_h
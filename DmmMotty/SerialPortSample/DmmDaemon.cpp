@@ -0,0 +1,280 @@
+//
+//  DmmDaemon.cpp
+//  SerialPortSample
+//
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Arduino.h"
+#include "DmmDaemon.h"
+
+#define DAEMON_BURST 14    // bytes the link may catch up by after a quiet spell
+#define DAEMON_FRAME_MAX 7 // longest frame, which the budget must cover before a send
+
+typedef struct {
+    unsigned char Func, Data;
+    unsigned int PeriodMs;
+} PollItem_t;
+
+static const PollItem_t PollItems[] = {
+    { General_Read,      Is_AbsPos32, DAEMON_POSITION_MS },
+    { Read_Drive_Status, 0,           DAEMON_STATUS_MS },
+    { Read_MainGain,     0,           DAEMON_SETTINGS_MS },
+    { Read_SpeedGain,    0,           DAEMON_SETTINGS_MS },
+    { Read_IntGain,      0,           DAEMON_SETTINGS_MS },
+    { Read_Drive_Config, 0,           DAEMON_SETTINGS_MS },
+};
+#define POLL_ITEMS (sizeof(PollItems) / sizeof(PollItems[0]))
+
+// Daemon process state, not shared
+static DaemonShared_t * Published;
+static unsigned long LastPoll[DAEMON_MAX_ID + 1][POLL_ITEMS];
+static unsigned char NextTurn;      // 0..DAEMON_MAX_CLIENTS, the last being the poller
+static float Budget;                // bytes the link can take now
+static unsigned long LastBudget, LastReap;
+
+static DaemonShared_t * MapShared(const char * name, bool create) {
+    void * map;
+    int fd = shm_open(name, create ? (O_CREAT | O_RDWR) : O_RDWR, DAEMON_SHM_MODE);
+    if (fd < 0) {
+        return NULL;
+    }
+    // A segment left by a daemon that crashed keeps its old mode otherwise
+    if (create && (fchmod(fd, DAEMON_SHM_MODE) != 0 || ftruncate(fd, sizeof(DaemonShared_t)) != 0)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sizeof(DaemonShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (map == MAP_FAILED) ? NULL : (DaemonShared_t *)map;
+}
+
+// Seqlock writer: readers retry while Seq is odd or has moved
+static void BeginWrite(AxisState_t * a) {
+    __atomic_store_n(&a->Seq, a->Seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void EndWrite(AxisState_t * a) {
+    __atomic_store_n(&a->Seq, a->Seq + 1, __ATOMIC_RELEASE);
+}
+
+static void Publish(char ID, unsigned char code, long value) {
+    AxisState_t * a = &Published->Axes[ID & 0x7f];
+    BeginWrite(a);
+    switch (code) {
+        case Is_AbsPos32: a->Position = value; a->PositionMs = millis(); break;
+        case Is_Status: a->Status = value; a->StatusMs = millis(); break;
+        case Is_Config: a->Config = value; break;
+        case Is_MainGain: a->MainGain = value; break;
+        case Is_SpeedGain: a->SpeedGain = value; break;
+        case Is_IntGain: a->IntGain = value; break;
+    }
+    EndWrite(a);
+}
+
+DaemonShared_t * DaemonCreate(const char * name) {
+    DaemonShared_t * shared = MapShared(name, true);
+    if (shared == NULL) {
+        return NULL;
+    }
+    memset(shared, 0, sizeof(*shared));
+    shared->Version = DAEMON_VERSION;
+    shared->DaemonPid = getpid();
+    __atomic_store_n(&shared->Magic, DAEMON_MAGIC, __ATOMIC_RELEASE);
+
+    Published = shared;
+    memset(LastPoll, 0, sizeof(LastPoll));
+    NextTurn = 0;
+    Budget = DAEMON_BURST;
+    LastBudget = micros();
+    LastReap = millis();
+    SetReadCallback(Publish);
+    return shared;
+}
+
+void DaemonAddAxis(DaemonShared_t * shared, char Axis_Num) {
+    AxisState_t * a = &shared->Axes[Axis_Num & 0x7f];
+    BeginWrite(a);
+    a->Present = 1;
+    EndWrite(a);
+}
+
+void DaemonDestroy(DaemonShared_t * shared, const char * name) {
+    __atomic_store_n(&shared->Magic, 0, __ATOMIC_RELEASE);
+    munmap(shared, sizeof(*shared));
+    shm_unlink(name);
+    Published = NULL;
+}
+
+// Free the rings of clients that exited without disconnecting
+static void Reap(DaemonShared_t * shared) {
+    ClientRing_t * ring;
+    unsigned char i;
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        ring = &shared->Clients[i];
+        if (__atomic_load_n(&ring->InUse, __ATOMIC_ACQUIRE) && ring->Pid
+            && kill(ring->Pid, 0) != 0 && errno == ESRCH) {
+            __atomic_store_n(&ring->Tail, __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+            ring->Pid = 0;
+            __atomic_store_n(&ring->InUse, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// The most overdue read of any present axis, false when nothing is due
+static bool NextPoll(DaemonShared_t * shared, unsigned long now, DaemonCommand_t * command) {
+    unsigned long late, latest = 0;
+    unsigned char id, item;
+    bool found = false;
+
+    for (id = 0; id <= DAEMON_MAX_ID; id++) {
+        if (!shared->Axes[id].Present) {
+            continue;
+        }
+        for (item = 0; item < POLL_ITEMS; item++) {
+            late = now - LastPoll[id][item];
+            if (late >= PollItems[item].PeriodMs && late - PollItems[item].PeriodMs >= latest) {
+                latest = late - PollItems[item].PeriodMs;
+                command->Func = PollItems[item].Func;
+                command->Axis = id;
+                command->Data = PollItems[item].Data;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+static bool NextCommand(ClientRing_t * ring, DaemonCommand_t * command) {
+    uint32_t tail = ring->Tail;
+    if (!__atomic_load_n(&ring->InUse, __ATOMIC_ACQUIRE) || tail == __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *command = ring->Ring[tail & (DAEMON_RING_SIZE - 1)];
+    __atomic_store_n(&ring->Tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// One pass of the daemon's loop: parse replies, then send at most one
+// frame, taking turns between the clients and the poller.
+void DaemonService(DaemonShared_t * shared) {
+    unsigned long now = millis(), us = micros();
+    DaemonCommand_t command;
+    unsigned char turn, n, item;
+    bool ready;
+
+    __atomic_store_n(&shared->Heartbeat, (uint32_t)now, __ATOMIC_RELAXED);
+    DmmSerialEvent();
+    if (now - LastReap >= DAEMON_REAP_MS) {
+        LastReap = now;
+        Reap(shared);
+    }
+
+    Budget = MIN(DAEMON_BURST, Budget + (us - LastBudget) * (DAEMON_BUS_BYTES_PER_SECOND / 1e6f));
+    LastBudget = us;
+    if (Budget < DAEMON_FRAME_MAX) {
+        return;
+    }
+
+    for (n = 0; n <= DAEMON_MAX_CLIENTS; n++) {
+        turn = (NextTurn + n) % (DAEMON_MAX_CLIENTS + 1);
+        if (turn == DAEMON_MAX_CLIENTS) {
+            ready = NextPoll(shared, now, &command);
+            if (ready) {
+                for (item = 0; PollItems[item].Func != command.Func; item++) ;
+                LastPoll[(unsigned char)command.Axis][item] = now;
+            }
+        } else {
+            ready = NextCommand(&shared->Clients[turn], &command);
+        }
+        if (ready) {
+            Budget -= Send_Package(command.Func, command.Axis, command.Data);
+            NextTurn = (turn + 1) % (DAEMON_MAX_CLIENTS + 1);
+            return;
+        }
+    }
+}
+
+DaemonShared_t * DaemonAttach(const char * name) {
+    DaemonShared_t * shared = MapShared(name, false);
+    if (shared == NULL) {
+        return NULL;
+    }
+    if (__atomic_load_n(&shared->Magic, __ATOMIC_ACQUIRE) != DAEMON_MAGIC || shared->Version != DAEMON_VERSION) {
+        munmap(shared, sizeof(*shared));
+        return NULL;
+    }
+    return shared;
+}
+
+void DaemonDetach(DaemonShared_t * shared) {
+    munmap(shared, sizeof(*shared));
+}
+
+// Claim a command ring. Returns its index, or -1 when all are taken. A ring
+// has one producer: give each thread that submits its own.
+int DaemonConnect(DaemonShared_t * shared) {
+    ClientRing_t * ring;
+    uint32_t expected;
+    int i;
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        ring = &shared->Clients[i];
+        expected = 0;
+        if (__atomic_compare_exchange_n(&ring->InUse, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            ring->Pid = getpid();
+            ring->Dropped = 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Hand over what is queued and release the ring
+void DaemonDisconnect(DaemonShared_t * shared, int client) {
+    ClientRing_t * ring = &shared->Clients[client];
+    while (__atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE) != ring->Head
+           && __atomic_load_n(&shared->Magic, __ATOMIC_ACQUIRE) == DAEMON_MAGIC) {
+        usleep(1000);
+    }
+    ring->Pid = 0;
+    __atomic_store_n(&ring->InUse, 0, __ATOMIC_RELEASE);
+}
+
+// Queue a command. Never blocks: returns false, and counts it in Dropped,
+// when the ring is full.
+bool DaemonSubmit(DaemonShared_t * shared, int client, unsigned char func, char Axis_Num, long data) {
+    ClientRing_t * ring = &shared->Clients[client];
+    uint32_t head = ring->Head;
+    DaemonCommand_t * command;
+
+    if (head - __atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE) >= DAEMON_RING_SIZE) {
+        ring->Dropped++;
+        return false;
+    }
+    command = &ring->Ring[head & (DAEMON_RING_SIZE - 1)];
+    command->Func = func;
+    command->Axis = Axis_Num;
+    command->Data = data;
+    __atomic_store_n(&ring->Head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consistent copy of an axis' state from the table. Returns false for an
+// axis the daemon isn't polling.
+bool DaemonReadAxis(const DaemonShared_t * shared, char Axis_Num, AxisState_t * state) {
+    const AxisState_t * a = &shared->Axes[Axis_Num & 0x7f];
+    uint32_t before, after;
+    do {
+        before = __atomic_load_n(&a->Seq, __ATOMIC_ACQUIRE);
+        memcpy(state, a, sizeof(*state));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&a->Seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    return state->Present;
+}
@@ -0,0 +1,95 @@
+//
+//  DmmDaemon.h
+//  SerialPortSample
+//
+//  Lets several processes (HMI, logger, planner) share one link. The
+//  daemon owns the serial port and a POSIX shared memory segment holding:
+//
+//  - one command ring per client, single producer/single consumer, so a
+//    client only ever touches its own ring and never waits on another;
+//  - a table of per-axis state (position, status, config, gains) that the
+//    daemon keeps fresh by polling and publishes under a seqlock, so
+//    clients read it at memory speed and reading costs no bus traffic.
+//
+//  The daemon serves the rings round robin, one frame per client per turn,
+//  with its own polling taking a turn like any client. Frames go out no
+//  faster than DAEMON_BUS_BYTES_PER_SECOND. One daemon serves one link;
+//  run one per port with different segment names (dmmdaemon -n).
+//
+
+#ifndef DmmDriver_DmmDaemon_h
+#define DmmDriver_DmmDaemon_h
+
+#include <stdint.h>
+#include "DmmDriver.h"
+
+#define DAEMON_SHM_NAME "/dmm-daemon"
+#ifndef DAEMON_SHM_MODE
+    // Whoever can write the segment can move the motors: only the daemon's
+    // user by default. For clients running as other users, build with 0660
+    // and run the daemon with a group of its own (sg dmm dmmdaemon ...).
+    #define DAEMON_SHM_MODE 0600
+#endif
+#define DAEMON_MAGIC 0x444D4D44 // "DMMD"
+#define DAEMON_VERSION 1
+
+#define DAEMON_MAX_CLIENTS 8
+#define DAEMON_RING_SIZE 256          // commands per client, a power of two
+#define DAEMON_MAX_ID 127
+
+#define DAEMON_BUS_BYTES_PER_SECOND 3840 // 38400 baud, 10 bits per byte
+#define DAEMON_POSITION_MS 20         // poll periods per axis
+#define DAEMON_STATUS_MS 100
+#define DAEMON_SETTINGS_MS 1000       // gains and config
+#define DAEMON_REAP_MS 1000           // check for clients that exited
+
+typedef struct {
+    uint8_t Func;
+    int8_t Axis;
+    int32_t Data;
+} DaemonCommand_t;
+
+typedef struct {
+    uint32_t Seq;                     // odd while the daemon is writing
+    uint8_t Present;                  // polled by the daemon
+    uint8_t Status, Config;
+    uint8_t MainGain, SpeedGain, IntGain;
+    int32_t Position;
+    uint32_t PositionMs;              // daemon millis() of the last position
+    uint32_t StatusMs;
+} AxisState_t;
+
+// Head and Tail sit on their own cache lines so the client and the daemon
+// don't bounce one line between them
+typedef struct {
+    uint32_t Head __attribute__((aligned(64))); // written by the client
+    uint32_t Dropped;                 // submissions refused with the ring full
+    uint32_t Tail __attribute__((aligned(64))); // written by the daemon
+    uint32_t InUse;                   // claimed by a client
+    uint32_t Pid;
+    DaemonCommand_t Ring[DAEMON_RING_SIZE] __attribute__((aligned(64)));
+} ClientRing_t;
+
+typedef struct {
+    uint32_t Magic, Version;
+    uint32_t DaemonPid;
+    uint32_t Heartbeat;               // daemon millis(), to tell it is alive
+    AxisState_t Axes[DAEMON_MAX_ID + 1];
+    ClientRing_t Clients[DAEMON_MAX_CLIENTS];
+} DaemonShared_t;
+
+// Daemon side
+DaemonShared_t * DaemonCreate(const char * name) ;
+void DaemonAddAxis(DaemonShared_t * shared, char Axis_Num) ;
+void DaemonService(DaemonShared_t * shared) ;
+void DaemonDestroy(DaemonShared_t * shared, const char * name) ;
+
+// Client side
+DaemonShared_t * DaemonAttach(const char * name) ;
+int DaemonConnect(DaemonShared_t * shared) ;
+bool DaemonSubmit(DaemonShared_t * shared, int client, unsigned char func, char Axis_Num, long data) ;
+bool DaemonReadAxis(const DaemonShared_t * shared, char Axis_Num, AxisState_t * state) ;
+void DaemonDisconnect(DaemonShared_t * shared, int client) ;
+void DaemonDetach(DaemonShared_t * shared) ;
+
+#endif // DmmDriver_DmmDaemon_h
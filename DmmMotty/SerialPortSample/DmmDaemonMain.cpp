@@ -0,0 +1,73 @@
+//
+//  DmmDaemonMain.cpp
+//  SerialPortSample
+//
+//  dmmdaemon [-n segment] <port> [id ...]
+//  Owns the port and serves DmmDaemon.h clients until interrupted. Without
+//  IDs the bus is searched with DiscoverDrives(). Each daemon needs its own
+//  segment name (DAEMON_SHM_NAME by default), so give -n to all but one
+//  when serving several ports.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "DmmDaemon.h"
+#include "DmmDiscover.h"
+
+#define DAEMON_DISCOVER_MS 5000 // enough for a full bus; an empty one takes well under 1 s
+
+static volatile sig_atomic_t Running = 1;
+
+static void Stop(int) {
+    Running = 0;
+}
+
+int main(int argc, char ** argv) {
+    static DiscoveredDrive_t drives[DAEMON_MAX_ID + 1];
+    const char * name = DAEMON_SHM_NAME;
+    DaemonShared_t * shared;
+    int count, i, option;
+
+    while ((option = getopt(argc, argv, "n:")) != -1) {
+        if (option != 'n') {
+            break;
+        }
+        name = optarg;
+    }
+    if (option == '?' || optind >= argc) {
+        fprintf(stderr, "usage: %s [-n segment] <port> [id ...]\n", argv[0]);
+        return 1;
+    }
+    if (openSerial(argv[optind]) != 0) {
+        return 1;
+    }
+    shared = DaemonCreate(name);
+    if (shared == NULL) {
+        perror("shared memory");
+        closeSerial();
+        return 1;
+    }
+    if (argc > optind + 1) {
+        for (i = optind + 1; i < argc; i++) {
+            DaemonAddAxis(shared, atoi(argv[i]));
+        }
+    } else {
+        count = DiscoverDrives(drives, DAEMON_MAX_ID + 1, DAEMON_DISCOVER_MS);
+        for (i = 0; i < count; i++) {
+            DaemonAddAxis(shared, drives[i].ID);
+        }
+    }
+
+    signal(SIGINT, Stop);
+    signal(SIGTERM, Stop);
+    while (Running) {
+        DaemonService(shared);
+        usleep(100);
+    }
+    DaemonDestroy(shared, name);
+    closeSerial();
+    return 0;
+}
@@ -0,0 +1,238 @@
+//
+//  DmmIoThread.cpp
+//  SerialPortSample
+//
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "DmmIoThread.h"
+
+// Bounded queue after D. Vyukov: each cell's Sequence tells producers it
+// is free (== position) and the consumer it is filled (== position + 1)
+typedef struct {
+    uint32_t Sequence;
+    unsigned char Func, ReplyCode; // ReplyCode: Is_ code awaited, 0 for commands
+    char Axis;
+    long Data;
+    IoCompletion_t * Done;
+} IoCell_t;
+
+typedef struct {
+    char Axis;
+    unsigned char ReplyCode;
+    IoCompletion_t * Done;
+    unsigned long Deadline; // micros(), IO_TIMEOUT_US after the frame is out
+    bool Busy;
+} IoRead_t;
+
+static IoCell_t Cells[IO_QUEUE_SIZE];
+static uint32_t EnqueuePos __attribute__((aligned(64)));
+static uint32_t DequeuePos __attribute__((aligned(64))); // I/O thread only
+static IoRead_t Reads[IO_WINDOW];
+static unsigned long LineFreeAt; // micros() when the frames sent so far are out
+static pthread_t Thread;
+static uint32_t Running;   // cleared to ask the I/O thread to stop
+static uint32_t Alive;     // cleared by the I/O thread once it completes nothing more
+
+static void Complete(IoCompletion_t * done, IoState_t state, long value) {
+    if (done) {
+        done->Value = value;
+        __atomic_store_n(&done->State, state, __ATOMIC_RELEASE);
+    }
+}
+
+// A drive answers in order, so a reply is for the oldest read of that
+// register: the one with the earliest deadline
+static void OnReply(char ID, unsigned char code, long value) {
+    IoRead_t * oldest = NULL;
+    unsigned char i;
+    for (i = 0; i < IO_WINDOW; i++) {
+        if (Reads[i].Busy && Reads[i].Axis == ID && Reads[i].ReplyCode == code
+            && (oldest == NULL || (long)(Reads[i].Deadline - oldest->Deadline) < 0)) {
+            oldest = &Reads[i];
+        }
+    }
+    if (oldest) {
+        oldest->Busy = false;
+        Complete(oldest->Done, Io_Done, value);
+    }
+}
+
+static IoRead_t * FreeRead() {
+    unsigned char i;
+    for (i = 0; i < IO_WINDOW; i++) {
+        if (!Reads[i].Busy) {
+            return &Reads[i];
+        }
+    }
+    return NULL;
+}
+
+// Take the next request if there is one and room to send it
+static bool Dequeue(IoCell_t * request) {
+    IoCell_t * cell = &Cells[DequeuePos & (IO_QUEUE_SIZE - 1)];
+    if (__atomic_load_n(&cell->Sequence, __ATOMIC_ACQUIRE) != DequeuePos + 1) {
+        return false;
+    }
+    if (cell->ReplyCode && FreeRead() == NULL) {
+        return false; // wait for a read slot, keeping requests in order
+    }
+    *request = *cell;
+    __atomic_store_n(&cell->Sequence, DequeuePos + IO_QUEUE_SIZE, __ATOMIC_RELEASE);
+    DequeuePos++;
+    return true;
+}
+
+static void * IoLoop(void *) {
+    unsigned long now;
+    IoCell_t request;
+    IoRead_t * read;
+    unsigned char i;
+    bool worked;
+
+    SetReadCallback(OnReply);
+    LineFreeAt = micros();
+    while (__atomic_load_n(&Running, __ATOMIC_ACQUIRE)) {
+        DmmSerialEvent();
+        now = micros();
+        for (i = 0; i < IO_WINDOW; i++) {
+            if (Reads[i].Busy && (long)(now - Reads[i].Deadline) >= 0) {
+                Reads[i].Busy = false;
+                Complete(Reads[i].Done, Io_Timeout, LONG_MIN);
+            }
+        }
+        worked = false;
+        // Keep no more than IO_LEAD_US of frames ahead of the wire, so a
+        // burst of commands waits here, where replies are still read
+        while ((long)(LineFreeAt - now) < IO_LEAD_US && Dequeue(&request)) {
+            if ((long)(LineFreeAt - now) < 0) {
+                LineFreeAt = now;
+            }
+            LineFreeAt += Send_Package(request.Func, request.Axis, request.Data) * DMM_BYTE_US;
+            if (request.ReplyCode) {
+                read = FreeRead();
+                read->Axis = request.Axis;
+                read->ReplyCode = request.ReplyCode;
+                read->Done = request.Done;
+                read->Deadline = LineFreeAt + IO_TIMEOUT_US;
+                read->Busy = true;
+            } else {
+                Complete(request.Done, Io_Done, 0);
+            }
+            worked = true;
+        }
+        if (!worked) {
+            usleep(IO_IDLE_US);
+        }
+    }
+    for (i = 0; i < IO_WINDOW; i++) {
+        if (Reads[i].Busy) {
+            Reads[i].Busy = false;
+            Complete(Reads[i].Done, Io_Timeout, LONG_MIN);
+        }
+    }
+    while (Dequeue(&request)) {
+        Complete(request.Done, Io_Timeout, LONG_MIN);
+    }
+    __atomic_store_n(&Alive, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+bool IoStart() {
+    unsigned int i;
+    for (i = 0; i < IO_QUEUE_SIZE; i++) {
+        Cells[i].Sequence = i;
+    }
+    for (i = 0; i < IO_WINDOW; i++) {
+        Reads[i].Busy = false;
+    }
+    EnqueuePos = DequeuePos = 0;
+    Running = Alive = 1;
+    if (pthread_create(&Thread, NULL, IoLoop, NULL) != 0) {
+        Running = Alive = 0;
+        return false;
+    }
+    return true;
+}
+
+// Requests still queued are dropped and, like reads in flight, complete as
+// timed out. Submitting after this fails.
+void IoStop() {
+    if (!__atomic_exchange_n(&Running, 0, __ATOMIC_ACQ_REL)) {
+        return; // never started, or already stopped
+    }
+    pthread_join(Thread, NULL);
+}
+
+// Queue a request from any thread. done, if given, goes to Io_Done once a
+// command is sent or a read answered, Io_Timeout if no reply came. Returns
+// false when the queue is full or the I/O thread isn't running.
+bool IoSubmit(unsigned char func, char Axis_Num, long data, IoCompletion_t * done) {
+    uint32_t pos = __atomic_load_n(&EnqueuePos, __ATOMIC_RELAXED);
+    IoCell_t * cell;
+    int32_t diff;
+
+    if (!__atomic_load_n(&Running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    for (;;) {
+        cell = &Cells[pos & (IO_QUEUE_SIZE - 1)];
+        diff = (int32_t)(__atomic_load_n(&cell->Sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&EnqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = __atomic_load_n(&EnqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+    if (done) {
+        done->State = Io_Pending;
+    }
+    cell->Func = func;
+    cell->Axis = Axis_Num;
+    cell->Data = data;
+    cell->ReplyCode = ReplyCodeOf(func, data);
+    cell->Done = done;
+    __atomic_store_n(&cell->Sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Wait for a completion; spins briefly, then yields. Returns true once the
+// request is finished, whichever way.
+bool IoWait(IoCompletion_t * done, unsigned int timeoutMs) {
+    unsigned long start = millis();
+    unsigned int spins = 0;
+    while (__atomic_load_n(&done->State, __ATOMIC_ACQUIRE) == Io_Pending) {
+        if (millis() - start >= timeoutMs) {
+            return false;
+        }
+        if (++spins > 100) {
+            sched_yield();
+        }
+    }
+    return true;
+}
+
+// QueryDrive() for any thread: LONG_MIN when there was no reply, the queue
+// was full or the I/O thread isn't running. The completion lives on this
+// stack, so this waits for the I/O thread to finish with it, at most
+// IO_TIMEOUT_US after the frame is out, or until the thread has exited: a request
+// that slipped in as IoStop() drained the queue is never completed.
+long IoQuery(unsigned char func, char Axis_Num, long data) {
+    IoCompletion_t done;
+    if (!IoSubmit(func, Axis_Num, data, &done)) {
+        return LONG_MIN;
+    }
+    while (!IoWait(&done, 1)) {
+        if (!__atomic_load_n(&Alive, __ATOMIC_ACQUIRE) && !IoWait(&done, 0)) {
+            return LONG_MIN;
+        }
+    }
+    return (done.State == Io_Done) ? done.Value : LONG_MIN;
+}
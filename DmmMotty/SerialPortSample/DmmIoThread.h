@@ -0,0 +1,40 @@
+//
+//  DmmIoThread.h
+//  SerialPortSample
+//
+//  Thread-safe access to the driver. The driver keeps its parse state and
+//  last reply in globals, so IoStart() confines it to one I/O thread and
+//  every other thread goes through a lock-free multi-producer queue:
+//  IoSubmit() claims a cell with one compare-and-swap and never takes a
+//  lock. A request may carry a caller-owned IoCompletion_t, which the
+//  I/O thread fills in when the command has gone out or the reply to a
+//  read has arrived (or its deadline has passed). Once IoStart() has been
+//  called, no other thread may call the driver directly.
+//
+
+#ifndef DmmDriver_DmmIoThread_h
+#define DmmDriver_DmmIoThread_h
+
+#include <stdint.h>
+#include "DmmDriver.h"
+
+#define IO_QUEUE_SIZE 1024     // requests, a power of two
+#define IO_WINDOW 4            // reads in flight
+#define IO_TIMEOUT_US 20000    // for a reply, from when the read is out on the wire
+#define IO_LEAD_US ((long)(2 * 7 * DMM_BYTE_US)) // frames written ahead of the wire: two of the longest
+#define IO_IDLE_US 100         // I/O thread sleep when there is nothing to do
+
+typedef enum { Io_Pending = 0, Io_Done, Io_Timeout } IoState_t;
+
+typedef struct {
+    uint32_t State;            // IoState_t, set by the I/O thread
+    long Value;                // the reply's value, for reads
+} IoCompletion_t;
+
+bool IoStart() ;
+void IoStop() ;
+bool IoSubmit(unsigned char func, char Axis_Num, long data, IoCompletion_t * done) ;
+bool IoWait(IoCompletion_t * done, unsigned int timeoutMs) ;
+long IoQuery(unsigned char func, char Axis_Num, long data) ;
+
+#endif // DmmDriver_DmmIoThread_h
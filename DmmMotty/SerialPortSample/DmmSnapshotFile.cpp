@@ -0,0 +1,33 @@
+//
+//  DmmSnapshotFile.cpp
+//  SerialPortSample
+//
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "DmmSnapshotFile.h"
+
+bool SaveDriveConfigs(const char * path, const DriveConfig_t * configs, unsigned char axes) {
+    unsigned char buffer[SNAPSHOT_BUFFER_SIZE(255)];
+    unsigned int length = EncodeDriveConfigs(configs, axes, buffer);
+    FILE * file = fopen(path, "wb");
+    bool ok;
+    if (file == NULL) {
+        return false;
+    }
+    ok = fwrite(buffer, 1, length, file) == length;
+    return (fclose(file) == 0) && ok;
+}
+
+// Returns the axes loaded, 0 when the file is missing or not a snapshot
+unsigned char LoadDriveConfigs(const char * path, DriveConfig_t * configs, unsigned char maxAxes) {
+    unsigned char buffer[SNAPSHOT_BUFFER_SIZE(255)];
+    unsigned int length;
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    length = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    return DecodeDriveConfigs(buffer, length, configs, maxAxes);
+}
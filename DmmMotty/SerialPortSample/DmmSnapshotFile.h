@@ -0,0 +1,17 @@
+//
+//  DmmSnapshotFile.h
+//  SerialPortSample
+//
+//  Keep drive configuration snapshots (see DmmSnapshot.h) in files, e.g.
+//  one per cell, written after commissioning and restored at startup.
+//
+
+#ifndef DmmDriver_DmmSnapshotFile_h
+#define DmmDriver_DmmSnapshotFile_h
+
+#include "DmmSnapshot.h"
+
+bool SaveDriveConfigs(const char * path, const DriveConfig_t * configs, unsigned char axes) ;
+unsigned char LoadDriveConfigs(const char * path, DriveConfig_t * configs, unsigned char maxAxes) ;
+
+#endif // DmmDriver_DmmSnapshotFile_h
@@ -0,0 +1,241 @@
+//
+//  DmmTrajectory.cpp
+//  SerialPortSample
+//
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Arduino.h"
+#include "DmmTrajectory.h"
+
+static void PutHeader(unsigned char * b, const TrajectoryHeader_t * header) {
+    memcpy(b, TRAJ_MAGIC, 4);
+    b[4] = TRAJ_VERSION;
+    b[5] = header->Axes;
+    b[6] = header->PeriodMs & 0xFF;
+    b[7] = header->PeriodMs >> 8;
+    b[8] = header->Count & 0xFF;
+    b[9] = (header->Count >> 8) & 0xFF;
+    b[10] = (header->Count >> 16) & 0xFF;
+    b[11] = (header->Count >> 24) & 0xFF;
+    memcpy(b + 12, header->Axis, TRAJ_MAX_AXES);
+}
+
+static bool GetHeader(const unsigned char * b, TrajectoryHeader_t * header) {
+    if (memcmp(b, TRAJ_MAGIC, 4) != 0 || b[4] != TRAJ_VERSION) {
+        return false;
+    }
+    header->Axes = b[5];
+    header->PeriodMs = b[6] | (b[7] << 8);
+    header->Count = b[8] | ((unsigned long)b[9] << 8) | ((unsigned long)b[10] << 16) | ((unsigned long)b[11] << 24);
+    memcpy(header->Axis, b + 12, TRAJ_MAX_AXES);
+    return header->Axes >= 1 && header->Axes <= TRAJ_MAX_AXES && header->PeriodMs > 0;
+}
+
+bool TrajectoryWriterOpen(TrajectoryWriter_t * writer, const char * path, const TrajectoryHeader_t * header) {
+    unsigned char b[TRAJ_HEADER_SIZE];
+    writer->Header = *header;
+    writer->Header.Count = 0; // filled in by TrajectoryWriterClose()
+    memset(writer->Last, 0, sizeof(writer->Last));
+    if (header->Axes < 1 || header->Axes > TRAJ_MAX_AXES || header->PeriodMs == 0) {
+        return false;
+    }
+    writer->File = fopen(path, "wb");
+    if (writer->File == NULL) {
+        return false;
+    }
+    PutHeader(b, &writer->Header);
+    if (fwrite(b, 1, sizeof(b), writer->File) != sizeof(b)) {
+        fclose(writer->File);
+        writer->File = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Positions are 32 bit, as the drive's, and so are the deltas (wrapping),
+// whatever the size of long: at most TRAJ_VARINT_MAX bytes per axis, and
+// the same file on 32 and 64 bit hosts. Returns false, writing nothing,
+// for a position out of that range, and when the write fails; either way
+// the writer is left as it was, so the setpoint can be appended again.
+bool TrajectoryWriterAppend(TrajectoryWriter_t * writer, const long * position) {
+    unsigned char b[TRAJ_MAX_AXES * TRAJ_VARINT_MAX];
+    unsigned int n = 0;
+    uint32_t d, v;
+    unsigned char i;
+    long at;
+    for (i = 0; i < writer->Header.Axes; i++) {
+        if (position[i] < INT32_MIN || position[i] > INT32_MAX) {
+            return false;
+        }
+    }
+    for (i = 0; i < writer->Header.Axes; i++) {
+        d = (uint32_t)position[i] - (uint32_t)writer->Last[i];
+        v = (d << 1) ^ (uint32_t)((int32_t)d >> 31); // zigzag
+        while (v >= 0x80) {
+            b[n++] = (v & 0x7F) | 0x80;
+            v >>= 7;
+        }
+        b[n++] = v;
+    }
+    at = ftell(writer->File);
+    if (fwrite(b, 1, n, writer->File) != n) {
+        fseek(writer->File, at, SEEK_SET); // a retry overwrites what did get out
+        return false;
+    }
+    for (i = 0; i < writer->Header.Axes; i++) {
+        writer->Last[i] = position[i];
+    }
+    writer->Header.Count++;
+    return true;
+}
+
+bool TrajectoryWriterClose(TrajectoryWriter_t * writer) {
+    unsigned char b[TRAJ_HEADER_SIZE];
+    bool ok;
+    PutHeader(b, &writer->Header);
+    ok = fseek(writer->File, 0, SEEK_SET) == 0 && fwrite(b, 1, sizeof(b), writer->File) == sizeof(b);
+    return (fclose(writer->File) == 0) && ok;
+}
+
+// Maps the file and checks the header; nothing else is read until the
+// setpoints are needed
+bool TrajectoryOpen(TrajectoryReader_t * reader, const char * path) {
+    struct stat st;
+    void * map;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < TRAJ_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    reader->Base = (const unsigned char *)map;
+    reader->Size = st.st_size;
+    if (!GetHeader(reader->Base, &reader->Header)) {
+        DMM_PRINTF("%s is not a trajectory file\n", path);
+        TrajectoryClose(reader);
+        return false;
+    }
+    madvise(map, reader->Size, MADV_SEQUENTIAL);
+    reader->Offset = TRAJ_HEADER_SIZE;
+    reader->LastUpdate = millis() - reader->Header.PeriodMs; // first setpoint goes out at once
+    return true;
+}
+
+void TrajectoryClose(TrajectoryReader_t * reader) {
+    if (reader->Base) {
+        munmap((void *)reader->Base, reader->Size);
+        reader->Base = NULL;
+    }
+}
+
+static bool ReadVarint(TrajectoryReader_t * reader, uint32_t * v) {
+    unsigned int shift = 0;
+    unsigned char b;
+    *v = 0;
+    while (reader->Offset < reader->Size && shift < TRAJ_VARINT_MAX * 7) {
+        b = reader->Base[reader->Offset++];
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+// Drop pages the stream has moved past, so they don't stay resident
+static void Release(TrajectoryReader_t * reader) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t upTo = reader->Offset / page * page;
+    if (upTo - reader->Released >= TRAJ_RELEASE_BYTES) {
+        madvise((void *)(reader->Base + reader->Released), upTo - reader->Released, MADV_DONTNEED);
+        reader->Released = upTo;
+    }
+}
+
+// Top up the lookahead window. Returns the setpoints now in it.
+unsigned int TrajectoryFill(TrajectoryReader_t * reader) {
+    Setpoint_t * s;
+    uint32_t v;
+    unsigned char i;
+
+    while (reader->WindowCount < TRAJ_LOOKAHEAD && reader->Decoded < reader->Header.Count && !reader->Corrupt) {
+        s = &reader->Window[(reader->WindowTop + reader->WindowCount) % TRAJ_LOOKAHEAD];
+        for (i = 0; i < reader->Header.Axes; i++) {
+            if (!ReadVarint(reader, &v)) {
+                DMM_PRINTF("Trajectory truncated at setpoint %lu\n", reader->Decoded);
+                reader->Corrupt = true;
+                return reader->WindowCount;
+            }
+            reader->Last[i] = (int32_t)((uint32_t)reader->Last[i] + ((v >> 1) ^ -(v & 1)));
+            s->Position[i] = reader->Last[i];
+        }
+        reader->Decoded++;
+        reader->WindowCount++;
+    }
+    Release(reader);
+    return reader->WindowCount;
+}
+
+// Setpoint ahead positions past the next one, NULL beyond the window or the
+// end of the file
+const Setpoint_t * TrajectoryPeek(TrajectoryReader_t * reader, unsigned int ahead) {
+    if (ahead >= reader->WindowCount) {
+        TrajectoryFill(reader);
+    }
+    if (ahead >= reader->WindowCount) {
+        return NULL;
+    }
+    return &reader->Window[(reader->WindowTop + ahead) % TRAJ_LOOKAHEAD];
+}
+
+bool TrajectoryNext(TrajectoryReader_t * reader, Setpoint_t * setpoint) {
+    if (reader->WindowCount == 0 && TrajectoryFill(reader) == 0) {
+        return false;
+    }
+    *setpoint = reader->Window[reader->WindowTop];
+    reader->WindowTop = (reader->WindowTop + 1) % TRAJ_LOOKAHEAD;
+    reader->WindowCount--;
+    return true;
+}
+
+// Call from the main loop. Sends one setpoint per PeriodMs to the drives
+// named in the header; when behind, skips to the latest setpoint due.
+// Returns true until the whole file has been sent.
+bool TrajectoryUpdate(TrajectoryReader_t * reader) {
+    const unsigned int period = reader->Header.PeriodMs;
+    unsigned long now = millis();
+    Setpoint_t s;
+    bool due = false;
+    unsigned char i;
+
+    if (now - reader->LastUpdate > 1000) { // not called for a while, don't replay it all
+        reader->LastUpdate = now - period;
+    }
+    while (now - reader->LastUpdate >= period && TrajectoryNext(reader, &s)) {
+        reader->LastUpdate += period;
+        reader->Sent++;
+        due = true;
+    }
+    if (due) {
+        for (i = 0; i < reader->Header.Axes; i++) {
+            MoveMotorToAbsolutePosition32(reader->Header.Axis[i], s.Position[i]);
+        }
+    }
+    TrajectoryFill(reader);
+    return reader->WindowCount > 0;
+}
@@ -0,0 +1,77 @@
+//
+//  DmmTrajectory.h
+//  SerialPortSample
+//
+//  Binary trajectory files for long jobs. A file is a 20 byte header
+//  (magic "DMMT", version, axis count, period in ms, setpoint count, drive
+//  IDs) followed by one record per setpoint: for each axis the 32 bit
+//  change from the previous position (from 0 for the first), zigzag
+//  encoded as a 7-bit varint, so small steps take one byte per axis.
+//
+//  The reader maps the file instead of loading it, decodes setpoints only
+//  as they are needed into a small lookahead window, and gives consumed
+//  pages back to the kernel, so motion starts at once and resident memory
+//  stays the same however long the job is. Host only (POSIX mmap).
+//
+
+#ifndef DmmDriver_DmmTrajectory_h
+#define DmmDriver_DmmTrajectory_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "DmmDriver.h"
+
+#define TRAJ_MAGIC "DMMT"
+#define TRAJ_VERSION 1
+#define TRAJ_HEADER_SIZE 20
+#define TRAJ_MAX_AXES 8
+#define TRAJ_VARINT_MAX 5 // bytes for a zigzag 32 bit delta
+
+#ifndef TRAJ_LOOKAHEAD
+    #define TRAJ_LOOKAHEAD 64 // setpoints decoded ahead of the stream
+#endif
+
+#define TRAJ_RELEASE_BYTES (1 << 20) // consumed bytes handed back to the kernel at a time
+
+typedef struct {
+    unsigned char Axes;
+    char Axis[TRAJ_MAX_AXES];     // drive IDs
+    unsigned int PeriodMs;        // time between setpoints
+    unsigned long Count;          // setpoints in the file
+} TrajectoryHeader_t;
+
+typedef struct {
+    long Position[TRAJ_MAX_AXES];
+} Setpoint_t;
+
+typedef struct {
+    TrajectoryHeader_t Header;
+    const unsigned char * Base;   // the mapping
+    size_t Size, Offset, Released;
+    long Last[TRAJ_MAX_AXES];     // last decoded position
+    unsigned long Decoded, Sent;
+    Setpoint_t Window[TRAJ_LOOKAHEAD];
+    unsigned int WindowTop, WindowCount;
+    bool Corrupt;                 // a record ran past the end of the file
+    unsigned long LastUpdate;
+} TrajectoryReader_t;
+
+typedef struct {
+    FILE * File;
+    TrajectoryHeader_t Header;
+    long Last[TRAJ_MAX_AXES];
+} TrajectoryWriter_t;
+
+bool TrajectoryWriterOpen(TrajectoryWriter_t * writer, const char * path, const TrajectoryHeader_t * header) ;
+bool TrajectoryWriterAppend(TrajectoryWriter_t * writer, const long * position) ;
+bool TrajectoryWriterClose(TrajectoryWriter_t * writer) ;
+
+bool TrajectoryOpen(TrajectoryReader_t * reader, const char * path) ;
+void TrajectoryClose(TrajectoryReader_t * reader) ;
+unsigned int TrajectoryFill(TrajectoryReader_t * reader) ;
+const Setpoint_t * TrajectoryPeek(TrajectoryReader_t * reader, unsigned int ahead) ;
+bool TrajectoryNext(TrajectoryReader_t * reader, Setpoint_t * setpoint) ;
+bool TrajectoryUpdate(TrajectoryReader_t * reader) ;
+
+#endif // DmmDriver_DmmTrajectory_h
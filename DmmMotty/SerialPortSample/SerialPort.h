@@ -9,15 +9,18 @@
 #ifndef DmmDriver_SerialPort_h
 #define DmmDriver_SerialPort_h
 
-#include <MacTypes.h>
+// Implemented by SerialPortSample.c on OS X, SerialPortPosix.c elsewhere
+#include <sys/types.h>
 
-long SerialAvailable();
+ssize_t SerialAvailable();
 int SerialRead();
-ssize_t SerialWrite(char b);
+void SerialWrite(char b);
 
 int openSerial(char *);
 void closeSerial();
 
 void delay(int millis);
+unsigned long millis();
+unsigned long micros();
 
 #endif // DmmDriver_SerialPort_h
@@ -0,0 +1,145 @@
+//
+//  SerialPortPosix.c
+//  SerialPortSample
+//
+//  SerialPort.h on Linux and other POSIX systems, with plain termios in
+//  place of the IOKit calls in SerialPortSample.c. Build one or the other;
+//  each compiles to nothing on the other's platform.
+//
+
+#ifndef __APPLE__
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <time.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#include "SerialPort.h"
+
+static struct termios OriginalAttrs;
+static int fileDescriptor = -1;
+
+static char Buffer[256];
+static ssize_t BufferCount = 0;
+static char * BufferNext = 0;
+
+static int openSerialPort(const char * path)
+{
+    struct termios options;
+    int fd;
+
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1) {
+        printf("Error opening serial port %s - %s(%d).\n", path, strerror(errno), errno);
+        return -1;
+    }
+    // O_NONBLOCK only so open() doesn't wait for carrier: clear it, so a
+    // write to a full transmit buffer sleeps instead of spinning. Reads
+    // still return at once, through VMIN and VTIME below.
+    if (ioctl(fd, TIOCEXCL) == -1 || fcntl(fd, F_SETFL, 0) == -1 || tcgetattr(fd, &OriginalAttrs) == -1) {
+        printf("Error setting up %s - %s(%d).\n", path, strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+
+    // Raw 8N1 at the drives' 38400 baud. Reads return at once with what is
+    // there: the driver polls SerialAvailable() from its own loop.
+    options = OriginalAttrs;
+    cfmakeraw(&options);
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    cfsetispeed(&options, B38400);
+    cfsetospeed(&options, B38400);
+    options.c_cflag |= CS8 | CREAD | CLOCAL;
+    options.c_cflag &= ~(PARENB | CSTOPB);
+    if (tcsetattr(fd, TCSANOW, &options) == -1) {
+        printf("Error setting tty attributes %s - %s(%d).\n", path, strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+
+#ifdef __linux__
+    // As IOSSDATALAT on OS X: hand received bytes over without the driver's
+    // batching delay (16 ms on most USB adapters). Not every port has it.
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &serial);
+    }
+#endif
+    return fd;
+}
+
+ssize_t SerialAvailable() {
+    if (BufferCount <= 0) {
+        BufferCount = read(fileDescriptor, Buffer, sizeof(Buffer));
+        BufferNext = (BufferCount > 0) ? Buffer : 0;
+    }
+    return (BufferCount > 0) ? BufferCount : 0;
+}
+
+int SerialRead() {
+    if (BufferCount <= 0 || BufferNext == 0) {
+        return -1;
+    }
+    BufferCount--;
+    return (unsigned char)*BufferNext++;
+}
+
+void SerialWrite(char b) {
+    while (write(fileDescriptor, &b, 1) == -1 && errno == EINTR) ;
+}
+
+int openSerial(char * path)
+{
+    fileDescriptor = openSerialPort(path);
+    BufferCount = 0;
+    return (fileDescriptor == -1) ? EX_IOERR : EX_OK;
+}
+
+void closeSerial()
+{
+    if (fileDescriptor == -1) {
+        return;
+    }
+    tcdrain(fileDescriptor);
+    tcsetattr(fileDescriptor, TCSANOW, &OriginalAttrs);
+    close(fileDescriptor);
+    fileDescriptor = -1;
+    printf("Serial Port Closed.\n");
+}
+
+void delay(int millis) {
+    usleep(millis * 1000);
+}
+
+static struct timespec Start;
+static pthread_once_t StartOnce = PTHREAD_ONCE_INIT;
+
+static void SetStart() {
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+}
+
+// Time since the first call, as the Arduino core counts it from reset. On
+// the monotonic clock, which a change of the date doesn't move.
+unsigned long micros() {
+    struct timespec now;
+    pthread_once(&StartOnce, SetStart);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - Start.tv_sec) * 1000000L + (now.tv_nsec - Start.tv_nsec) / 1000);
+}
+
+unsigned long millis() {
+    return micros() / 1000;
+}
+
+#endif // !__APPLE__
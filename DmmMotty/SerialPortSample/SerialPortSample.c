@@ -45,6 +45,8 @@
  
  */
 
+#ifdef __APPLE__ // SerialPortPosix.c elsewhere
+
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -58,6 +60,7 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <time.h>
+#include <pthread.h>
 #include <CoreFoundation/CoreFoundation.h>
 #include <IOKit/IOKitLib.h>
 #include <IOKit/serial/ioss.h>
@@ -474,3 +477,25 @@ void closeSerial()
 void delay(int millis) {
     usleep(millis * 1000);
 }
+
+static struct timespec Start;
+static pthread_once_t StartOnce = PTHREAD_ONCE_INIT;
+
+static void SetStart() {
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+}
+
+// Time since the first call, as the Arduino core counts it from reset. On
+// the monotonic clock, which a change of the date doesn't move.
+unsigned long micros() {
+    struct timespec now;
+    pthread_once(&StartOnce, SetStart);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - Start.tv_sec) * 1000000L + (now.tv_nsec - Start.tv_nsec) / 1000);
+}
+
+unsigned long millis() {
+    return micros() / 1000;
+}
+
+#endif // __APPLE__